@@ -0,0 +1,90 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "bench.h"
+
+uint64_t
+bench_now ()
+{
+  struct timespec t;
+
+  clock_gettime (CLOCK_MONOTONIC, &t);
+
+  return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void
+le32 (p, x)
+     uint8_t	*p;
+     uint32_t	x;
+{
+  p[0] = x;
+  p[1] = x >> 8;
+  p[2] = x >> 16;
+  p[3] = x >> 24;
+}
+
+/* a binary of the `t` words of `text` and `d` words of `data` */
+uint8_t *
+bench_image (text, t, data, d, length)
+     const uint32_t	*text;
+     uint32_t		t;
+     const uint32_t	*data;
+     uint32_t		d;
+     size_t		*length;
+{
+  uint8_t	*p;
+  uint32_t	i;
+
+  *length = 24 + 4 * ((size_t)t + d) + 1;
+  p = calloc (*length, 1);
+
+  if (!p)
+    return NULL;
+
+  memcpy (p, "YSWD", 4);
+  le32 (p + 4, 4 * (t + d) + 22);
+  le32 (p + 8, 4 * t);
+  le32 (p + 12, 4 * d);
+
+  for (i = 0; i < t; i++)
+    le32 (p + 24 + 4 * i, text[i]);
+
+  for (i = 0; i < d; i++)
+    le32 (p + 24 + 4 * (t + i), data[i]);
+
+  return p;
+}
+
+/* silences the VM's own output while `off` is set */
+void
+bench_quiet (off)
+     bool off;
+{
+  static int	saved = -1;
+  int		null;
+
+  fflush (stdout);
+
+  if (off)
+    {
+      null = open ("/dev/null", O_WRONLY);
+      saved = dup (STDOUT_FILENO);
+
+      if (null >= 0 && saved >= 0)
+	dup2 (null, STDOUT_FILENO);
+
+      if (null >= 0)
+	close (null);
+    }
+  else if (saved >= 0)
+    {
+      dup2 (saved, STDOUT_FILENO);
+      close (saved);
+      saved = -1;
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef YESOD_BENCH_
+# define YESOD_BENCH_
+
+# include <stdbool.h>
+# include <stddef.h>
+# include <stdint.h>
+# include "decoder.h"
+
+/* instructions, see decoder.h */
+# define C1(op, rd, rs)   ((op) << 2 | (rd) << 8 | (rs) << 16)
+# define C2(op, rd, imm)  (1 | (op) << 2 | (rd) << 8 | ((imm) & 0xFFFF) << 16)
+# define C3(op, rs, cc)   (2 | (op) << 2 | (rs) << 8 | (cc) << 16)
+# define C4(op, rp, imm, cc)						\
+  (3 | (op) << 2 | (rp) << 8 | (cc) << 12 | ((imm) & 0xFFFF) << 16)
+
+/* class I with `rs` shifted by `n` */
+# define C1S(op, rd, rs, sh, n)					\
+  (C1 (op, rd, rs) | (sh) << 12 | 1 << 23 | (n) << 24)
+
+/* class I with `rs` shifted by register `rh` */
+# define C1R(op, rd, rs, sh, rh)					\
+  (C1 (op, rd, rs) | (sh) << 12 | (rh) << 24)
+
+/* class I of size `sz`, and class I with a condition */
+# define C1Z(op, rd, rs, sz) (C1 (op, rd, rs) | (sz) << 14)
+# define C1C(op, rd, rs, cc) (C1 (op, rd, rs) | (cc) << 20)
+
+/* class II on the upper half of `rd` */
+# define C2U(op, rd, imm) (C2 (op, rd, imm) | 1 << 15)
+
+/* jumps pushing their return address */
+# define C3P(op, rs, cc)       (C3 (op, rs, cc) | 1 << 19)
+# define C4P(op, rp, imm, cc)  (C4 (op, rp, imm, cc) | 1 << 15)
+
+uint64_t	bench_now (void);
+uint8_t		*bench_image (const uint32_t *, uint32_t, const uint32_t *,
+			      uint32_t, size_t *);
+void		bench_quiet (bool);
+
+#endif /* YESOD_BENCH_ */
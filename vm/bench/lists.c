@@ -0,0 +1,151 @@
+/*
+ * list traversal benchmark
+ *
+ * builds a list of ELEMENTS words through the LIST service, once made
+ * of normal cells and once CDR-coded (see heap.h), and times ROUNDS
+ * traversals of it by a guest loop of CAR, CDR and a conditional jump,
+ * with both engines
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm.h"
+#include "run.h"
+#include "bench.h"
+
+#ifndef ELEMENTS
+# define ELEMENTS (1 << 20)
+#endif
+
+#ifndef ROUNDS
+# define ROUNDS (20)
+#endif
+
+#define MEMORY (32 << 20)
+
+/*
+ * x7 runs through the list, x10 xors its elements. flags only ever
+ * get set, so the loop ends on carry, which x6 - x7 sets once x7 is 0
+ */
+static const uint32_t traverse[] = {
+  C1 (CAR, 1, 7),
+  C1 (XOR, 10, 1),
+  C1 (CDR, 7, 7),
+  C1 (CMP, 6, 7),
+  C4 (JR, 5, -16, GEU),
+  C1 (HLT, 0, 0)
+};
+
+#define TEXT (sizeof (traverse) / 4)
+
+static int
+bench (p, length, coded, engine)
+     uint8_t		*p;
+     size_t		length;
+     bool		coded;
+     enum yesod_engine	engine;
+{
+  struct yesod_vm	vm;
+  struct yesod_stop	stop;
+  FILE			*f;
+  uint32_t		list, expect = 0, i;
+  uint64_t		start, t = 0;
+
+  if (yesod_init_vm (&vm, MEMORY, 128))
+    return 1;
+
+  vm.cons.coded = coded;
+  vm.engine = engine;
+
+  f = fmemopen (p, length, "r");
+
+  if (!f || yesod_init_prog (&vm, f))
+    {
+      if (f)
+	fclose (f);
+
+      yesod_destroy_vm (&vm);
+
+      return 1;
+    }
+
+  fclose (f);
+
+  list = yesod_heap_list (&vm, vm.data, ELEMENTS);
+
+  for (i = 0; i < ELEMENTS; i++)
+    expect ^= 2 * i + 1;
+
+  for (i = 0; i < ROUNDS; i++)
+    {
+      memset (vm.regs, 0, sizeof (vm.regs));
+      vm.regs[5] = 0xFFFF;
+      vm.regs[6] = 2;
+      vm.regs[7] = list;
+      vm.regs[PC] = vm.text;
+      yesod_flags (&vm);
+      vm.flags = 0;
+
+      start = bench_now ();
+      stop = yesod_run (&vm, YESOD_UNLIMITED);
+      t += bench_now () - start;
+
+      if (stop.reason != YESOD_HALT || vm.regs[10] != expect)
+	{
+	  fprintf (stderr, "lists: traversal stopped by %s with %#010x\n",
+		   yesod_stop_name (stop.reason), vm.regs[10]);
+	  yesod_destroy_vm (&vm);
+
+	  return 1;
+	}
+    }
+
+  printf ("%-8s %-9s %5.1f %10.1f %10.2f\n",
+	  coded ? "coded" : "normal",
+	  engine == YESOD_ENGINE_THREADED ? "threaded" : "switch",
+	  (double)vm.cons.allocated / ELEMENTS,
+	  (double)ELEMENTS * ROUNDS * 1e3 / t,
+	  (double)t / ((double)ELEMENTS * ROUNDS));
+
+  yesod_destroy_vm (&vm);
+
+  return 0;
+}
+
+int
+main ()
+{
+  uint32_t	*data = malloc (4 * ELEMENTS), i;
+  uint8_t	*p = NULL;
+  size_t	length;
+  int		err;
+
+  /* the odd numbers from 1 */
+  for (i = 0; data && i < ELEMENTS; i++)
+    data[i] = 2 * i + 1;
+
+  if (data)
+    p = bench_image (traverse, TEXT, data, ELEMENTS, &length);
+
+  free (data);
+
+  if (!p)
+    {
+      perror ("lists");
+      return EXIT_FAILURE;
+    }
+
+  printf ("%u elements, %u rounds\n", ELEMENTS, ROUNDS);
+  printf ("%-8s %-9s %5s %10s %10s\n",
+	  "layout", "engine", "B/elt", "Melt/s", "ns/elt");
+
+  err = bench (p, length, false, YESOD_ENGINE_SWITCH)
+    || bench (p, length, true, YESOD_ENGINE_SWITCH)
+    || bench (p, length, false, YESOD_ENGINE_THREADED)
+    || bench (p, length, true, YESOD_ENGINE_THREADED);
+
+  free (p);
+
+  return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,637 @@
+/*
+ * component microbenchmarks
+ *
+ * times `yesod_decode` over random words of each class and over a mix
+ * of real ones, `yesod_init_prog` over images of 2^10 to 2^16 words,
+ * and `yesod_cycle` over straight runs of each opcode. a component is
+ * repeated until a round of it takes MINIMUM ns, and its time is the
+ * median of ROUNDS rounds, taken in turn with the other components,
+ * in nanoseconds per decode, per load or per cycle. its spread is the
+ * median absolute deviation of the rounds, scaled to estimate a
+ * standard deviation
+ *
+ * results are written as a flat JSON object of names and times, with
+ * `-o`, the spread of a component under its name and `.spread`. given
+ * a baseline in that format with `-b`, the harness fails if any
+ * component got slower than its baseline by more than both the
+ * threshold, in percent, given with `-T`, and SPREADS times the spread
+ * of the difference. the spread is that of a round rather than of the
+ * median, as the host drifts more from one run to the next than the
+ * rounds of a run tell
+ *
+ * times only compare on one host, so no baseline is kept with the
+ * sources: `make baseline` records bench/baseline.json, which `make
+ * micro` needs
+ */
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm.h"
+#include "cycle.h"
+#include "bench.h"
+
+#ifndef ROUNDS
+# define ROUNDS (21)
+#endif
+
+/* shortest round, in ns */
+#define MINIMUM (5000000)
+
+/* spreads of a difference that are still noise */
+#define SPREADS (3)
+
+/* words decoded */
+#define WORDS (4096)
+
+/* copies of the instruction of a dispatch run */
+#define COPIES (1024)
+
+#define MEMORY (4 << 20)
+
+/* most results, and length of their names */
+#define RESULTS (64)
+#define NAME    (32)
+
+struct result {
+  char		name[NAME];
+  double	ns;
+  double	spread;
+};
+
+static struct result	results[RESULTS];
+static int		nresults;
+
+/* sink for what is computed only to be timed */
+static volatile uint32_t sink;
+
+static void
+record (name, ns, spread)
+     const char	*name;
+     double	ns;
+     double	spread;
+{
+  if (nresults == RESULTS)
+    return;
+
+  strncpy (results[nresults].name, name, NAME - 1);
+  results[nresults].name[NAME - 1] = 0;
+  results[nresults].ns = ns;
+  results[nresults++].spread = spread;
+
+  printf ("%-24s %10.2f ns %8.2f spread\n", name, ns, spread);
+}
+
+static int
+ascending (a, b)
+     const void *a;
+     const void *b;
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/*
+ * a component: `per` operations, done `n` times a round by `run`,
+ * which gives the ns they took, or returns 1 on error
+ */
+struct component {
+  char		name[NAME];
+  int		(*run) (void *, uint32_t, uint64_t *);
+  void		*arg;
+  uint32_t	per;
+  uint32_t	n;
+  uint64_t	t[ROUNDS];
+};
+
+static struct component	components[RESULTS];
+static int		ncomponents;
+
+/* adds a component, doubling `n` until a round takes MINIMUM ns */
+static int
+add (name, run, arg, per)
+     const char	*name;
+     int	(*run) (void *, uint32_t, uint64_t *);
+     void	*arg;
+     uint32_t	per;
+{
+  struct component	*c = &components[ncomponents];
+  uint64_t		t;
+
+  if (ncomponents == RESULTS)
+    return 0;
+
+  for (c->n = 1; ; c->n *= 2)
+    {
+      if (run (arg, c->n, &t))
+	return 1;
+
+      if (t >= MINIMUM || c->n >= 1u << 30)
+	break;
+    }
+
+  strncpy (c->name, name, NAME - 1);
+  c->name[NAME - 1] = 0;
+  c->run = run;
+  c->arg = arg;
+  c->per = per;
+  ncomponents++;
+
+  return 0;
+}
+
+/*
+ * times every component ROUNDS times, a round of each in turn, so that
+ * the host slowing down for a while spreads over all of them rather
+ * than moving the median of a few
+ */
+static int
+measure ()
+{
+  struct component	*c;
+  uint64_t		d[ROUNDS], median;
+  double		ops;
+  int			i, r;
+
+  for (r = 0; r < ROUNDS; r++)
+    for (i = 0; i < ncomponents; i++)
+      if (components[i].run (components[i].arg, components[i].n,
+			     &components[i].t[r]))
+	return 1;
+
+  for (i = 0; i < ncomponents; i++)
+    {
+      c = &components[i];
+      qsort (c->t, ROUNDS, sizeof (*c->t), ascending);
+      median = c->t[ROUNDS / 2];
+
+      for (r = 0; r < ROUNDS; r++)
+	d[r] = c->t[r] > median ? c->t[r] - median : median - c->t[r];
+
+      qsort (d, ROUNDS, sizeof (*d), ascending);
+
+      ops = (double)c->per * c->n;
+      record (c->name, median / ops, 1.4826 * d[ROUNDS / 2] / ops);
+    }
+
+  return 0;
+}
+
+/* xorshift32 */
+static uint32_t
+next (x)
+     uint32_t *x;
+{
+  *x ^= *x << 13;
+  *x ^= *x >> 17;
+  *x ^= *x << 5;
+
+  return *x;
+}
+
+/* instructions as compilers of the machine emit them */
+static const uint32_t real[] = {
+  C2 (MOV, 8, 1),
+  C2U (OR, 9, 0x7FF8),
+  C1 (ADD, 1, 2),
+  C1 (XOR, 3, 1),
+  C1 (SUB, 6, 2),
+  C1 (CAR, 1, 7),
+  C1 (CDR, 7, 7),
+  C1Z (STR, 7, 1, BYTE),
+  C1S (MOV, 1, 9, LSL, 3),
+  C1R (XOR, 4, 9, LSL, 6),
+  C1 (CMP, 11, 13),
+  C4 (JR, 5, -24, GEU),
+  C4P (JA, 12, 0xF000, ALW),
+  C3 (JA, 1, ALW),
+  C1 (HLT, 0, 0)
+};
+
+#define REAL (sizeof (real) / sizeof (*real))
+
+/* decodes the WORDS words at `arg` `n` times */
+static int
+decode (arg, n, ns)
+     void	*arg;
+     uint32_t	n;
+     uint64_t	*ns;
+{
+  const uint32_t		*words = arg;
+  struct yesod_instruction	i;
+  uint64_t			start = bench_now ();
+  uint32_t			k;
+
+  while (n--)
+    for (k = 0; k < WORDS; k++)
+      {
+	i = yesod_decode (words[k]);
+	sink += i.class;
+      }
+
+  *ns = bench_now () - start;
+
+  return 0;
+}
+
+/* random words of each class, then real ones */
+static uint32_t decoded[5][WORDS];
+
+static int
+decoding ()
+{
+  uint32_t	seed = 2463534242u, k;
+  int		c;
+  char		name[NAME];
+
+  for (c = 0; c < 4; c++)
+    {
+      for (k = 0; k < WORDS; k++)
+	decoded[c][k] = (next (&seed) & ~(uint32_t)3) | c;
+
+      sprintf (name, "decode.class%d", c + 1);
+
+      if (add (name, decode, decoded[c], WORDS))
+	return 1;
+    }
+
+  for (k = 0; k < WORDS; k++)
+    decoded[4][k] = real[k % REAL];
+
+  return add ("decode.real", decode, decoded[4], WORDS);
+}
+
+/* a VM with `p` loaded, or 1, timing `yesod_init_prog` into `ns` */
+static int
+load (vm, p, length, ns)
+     struct yesod_vm	*vm;
+     uint8_t		*p;
+     size_t		length;
+     uint64_t		*ns;
+{
+  FILE		*f;
+  uint64_t	start;
+  int		err;
+
+  memset (vm, 0, sizeof (*vm));
+  bench_quiet (true);
+  err = yesod_init_vm (vm, MEMORY, 4096);
+
+  if (!err)
+    {
+      f = fmemopen (p, length, "r");
+      start = bench_now ();
+      err = !f || yesod_init_prog (vm, f);
+      *ns = bench_now () - start;
+
+      if (f)
+	fclose (f);
+
+      if (err)
+	yesod_destroy_vm (vm);
+    }
+
+  bench_quiet (false);
+
+  if (err)
+    fprintf (stderr, "micro: could not load an image of %lu bytes\n",
+	     (unsigned long)length);
+
+  return err;
+}
+
+/* an image, and its length */
+struct image {
+  uint8_t	*p;
+  size_t	length;
+};
+
+/* loads the image at `arg` `n` times, timing `yesod_init_prog` only */
+static int
+reload (arg, n, ns)
+     void	*arg;
+     uint32_t	n;
+     uint64_t	*ns;
+{
+  struct image		*image = arg;
+  struct yesod_vm	vm;
+  uint64_t		t;
+
+  for (*ns = 0; n--; *ns += t)
+    {
+      if (load (&vm, image->p, image->length, &t))
+	return 1;
+
+      yesod_destroy_vm (&vm);
+    }
+
+  return 0;
+}
+
+/* images of 2^10, 2^13 and 2^16 words of real instructions */
+static struct image images[3];
+
+static int
+loading ()
+{
+  struct image	*image = images;
+  uint32_t	*text, words, k;
+  char		name[NAME];
+
+  for (words = 1 << 10; words <= 1 << 16; words <<= 3, image++)
+    {
+      text = malloc (4 * words);
+
+      for (k = 0; text && k < words; k++)
+	text[k] = real[k % REAL];
+
+      if (text)
+	image->p = bench_image (text, words, NULL, 0, &image->length);
+
+      free (text);
+      sprintf (name, "load.%uk", words >> 10);
+
+      if (!image->p || add (name, reload, image, 1))
+	return 1;
+    }
+
+  return 0;
+}
+
+/*
+ * runs of COPIES of each opcode, then HLT. x2 holds 3, x3 4 for jumps
+ * to the next instruction, and x7 an address in the stack
+ */
+static const struct {
+  const char	*name;
+  uint32_t	word;
+} dispatched[] = {
+  { "nop", C1 (NOP, 0, 0) },
+  { "mov", C1 (MOV, 1, 2) },
+  { "movi", C2 (MOV, 1, 3) },
+  { "add", C1 (ADD, 1, 2) },
+  { "sub", C1 (SUB, 1, 2) },
+  { "and", C1 (AND, 1, 2) },
+  { "or", C1 (OR, 1, 2) },
+  { "xor", C1 (XOR, 1, 2) },
+  { "cmp", C1 (CMP, 1, 2) },
+  { "shift", C1S (MOV, 1, 2, LSL, 3) },
+  { "car", C1 (CAR, 1, 7) },
+  { "cdr", C1 (CDR, 1, 7) },
+  { "str", C1 (STR, 7, 2) },
+  { "jr", C3 (JR, 3, ALW) },
+  { "jri", C4 (JR, 0, 4, ALW) },
+  { "skipped", C1C (ADD, 1, 2, LTU) }
+};
+
+#define DISPATCHED (sizeof (dispatched) / sizeof (*dispatched))
+
+/* runs the COPIES instructions of the VM at `arg` `n` times */
+static int
+dispatch (arg, n, ns)
+     void	*arg;
+     uint32_t	n;
+     uint64_t	*ns;
+{
+  struct yesod_vm	*vm = arg;
+  uint64_t		start = bench_now ();
+  uint32_t		k;
+
+  while (n--)
+    {
+      vm->regs[2] = 3;
+      vm->regs[3] = 4;
+      vm->regs[7] = 0x100;
+      vm->regs[PC] = vm->text;
+
+      for (k = 0; k < COPIES; k++)
+	yesod_cycle (vm);
+    }
+
+  *ns = bench_now () - start;
+
+  return 0;
+}
+
+/* a VM for each of them, the first `nvms` of which are loaded */
+static struct yesod_vm	vms[DISPATCHED];
+static int		nvms;
+
+static int
+dispatching ()
+{
+  uint32_t		text[COPIES + 1], k;
+  uint8_t		*p;
+  size_t		length;
+  uint64_t		ns;
+  char			name[NAME];
+
+  for (; nvms < (int)DISPATCHED; nvms++)
+    {
+      for (k = 0; k < COPIES; k++)
+	text[k] = dispatched[nvms].word;
+
+      text[COPIES] = C1 (HLT, 0, 0);
+      p = bench_image (text, COPIES + 1, NULL, 0, &length);
+
+      if (!p || load (&vms[nvms], p, length, &ns))
+	{
+	  free (p);
+	  return 1;
+	}
+
+      free (p);
+      sprintf (name, "dispatch.%s", dispatched[nvms].name);
+
+      if (add (name, dispatch, &vms[nvms], COPIES))
+	{
+	  nvms++;
+	  return 1;
+	}
+    }
+
+  return 0;
+}
+
+static void
+release ()
+{
+  int i;
+
+  for (i = 0; i < 3; i++)
+    free (images[i].p);
+
+  while (nvms)
+    yesod_destroy_vm (&vms[--nvms]);
+}
+
+static int
+save (path)
+     const char *path;
+{
+  FILE	*f = fopen (path, "w");
+  int	i;
+
+  if (!f)
+    {
+      perror ("micro");
+      return 1;
+    }
+
+  fprintf (f, "{\n");
+
+  for (i = 0; i < nresults; i++)
+    fprintf (f, "  \"%s\": %.3f,\n  \"%s.spread\": %.3f%s\n",
+	     results[i].name, results[i].ns, results[i].name,
+	     results[i].spread, i == nresults - 1 ? "" : ",");
+
+  fprintf (f, "}\n");
+
+  return fclose (f) ? 1 : 0;
+}
+
+/* the value of `name` in the baseline, or -1 */
+static double
+lookup (base, n, name)
+     const struct result	*base;
+     int			n;
+     const char			*name;
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    if (!strcmp (base[i].name, name))
+      return base[i].ns;
+
+  return -1;
+}
+
+/*
+ * compares the results with the baseline at `path`, which only needs
+ * to be a JSON object of names and numbers, and may have no spreads.
+ * returns the number of components slower than their baseline by more
+ * than `threshold` % and SPREADS spreads of the difference
+ */
+static int
+compare (path, threshold)
+     const char	*path;
+     double	threshold;
+{
+  FILE			*f = fopen (path, "r");
+  struct result		base[2 * RESULTS];
+  char			name[NAME + sizeof (".spread")];
+  double		ns, spread, margin;
+  int			c, len, i, n = 0, slower = 0;
+
+  if (!f)
+    {
+      perror ("micro");
+      return -1;
+    }
+
+  while ((c = getc (f)) != EOF && n < 2 * RESULTS)
+    {
+      if (c != '"')
+	continue;
+
+      for (len = 0; (c = getc (f)) != EOF && c != '"'; )
+	if (len < NAME - 1)
+	  base[n].name[len++] = c;
+
+      base[n].name[len] = 0;
+
+      if (fscanf (f, " : %lf", &base[n].ns) == 1)
+	n++;
+    }
+
+  fclose (f);
+
+  printf ("\n%-24s %10s %10s %8s %8s\n", "component", "ns", "baseline",
+	  "change", "margin");
+
+  for (i = 0; i < nresults; i++)
+    {
+      ns = lookup (base, n, results[i].name);
+      sprintf (name, "%s.spread", results[i].name);
+      spread = lookup (base, n, name);
+
+      if (ns <= 0)
+	continue;
+
+      spread = spread < 0 ? 0 : spread;
+      spread = sqrt (spread * spread
+		     + results[i].spread * results[i].spread);
+      margin = SPREADS * spread > ns * threshold / 100
+	? SPREADS * spread : ns * threshold / 100;
+
+      printf ("%-24s %10.2f %10.2f %+7.1f%% %7.1f%%%s\n", results[i].name,
+	      results[i].ns, ns, 100 * (results[i].ns - ns) / ns,
+	      100 * margin / ns, results[i].ns > ns + margin ? "  slower" : "");
+
+      if (results[i].ns > ns + margin)
+	slower++;
+    }
+
+  return slower;
+}
+
+int
+main (argc, argv)
+     int argc;
+     char *const argv[];
+{
+  const char	*out = NULL, *baseline = NULL;
+  double	threshold = 10;
+  int		opt, slower;
+
+  while ((opt = getopt (argc, argv, "b:o:T:")) != -1)
+    {
+      switch (opt)
+	{
+	case 'b':
+	  baseline = optarg;
+	  break;
+	case 'o':
+	  out = optarg;
+	  break;
+	case 'T':
+	  threshold = strtod (optarg, NULL);
+	  break;
+	default:
+	  fprintf (stderr, "usage: %s [-b baseline] [-o results] [-T threshold]\n",
+		   argv[0]);
+	  return EXIT_FAILURE;
+	}
+    }
+
+  if (decoding () || loading () || dispatching () || measure ())
+    {
+      release ();
+      return EXIT_FAILURE;
+    }
+
+  release ();
+
+  if (out && save (out))
+    return EXIT_FAILURE;
+
+  if (!baseline)
+    return EXIT_SUCCESS;
+
+  slower = compare (baseline, threshold);
+
+  if (slower)
+    {
+      if (slower > 0)
+	fprintf (stderr, "micro: %d components slower than their baseline "
+		 "by more than %.1f%% and their spread\n", slower,
+		 threshold);
+
+      return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
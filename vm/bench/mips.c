@@ -0,0 +1,225 @@
+/*
+ * MIPS harness
+ *
+ * runs YSWD binaries, such as the ones of bench/programs, ROUNDS times
+ * each after a warm-up run, every run in a VM of its own with a stack
+ * of STACK_SIZE bytes. the switch engine runs them unless -t picks the
+ * threaded one, whose JIT -J turns off, and only -M turns checked mode
+ * (see tlb.h) on; `make bench` runs them in several of these modes
+ *
+ * a line per binary gives the instructions a run retires, the mean,
+ * lowest and standard deviation of its wall time, the millions of
+ * instructions per second of the mean, and a hash of the registers and
+ * flags it ends with. only the times, and what they are worked out
+ * into, depend on the host, so that the output of two builds can be
+ * diffed
+ *
+ * runs that do not halt, or end with other registers than the warm-up,
+ * fail the harness
+ */
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm.h"
+#include "run.h"
+#include "bench.h"
+
+#ifndef ROUNDS
+# define ROUNDS (10)
+#endif
+
+#define MEMORY     (8 << 20)
+#define STACK_SIZE (1 << 20)
+
+/* FNV-1a of the registers and flags */
+static uint32_t
+hash (vm)
+     struct yesod_vm *vm;
+{
+  uint32_t	h = 2166136261u;
+  uint8_t	*p = (uint8_t *)vm->regs;
+  size_t	i;
+
+  for (i = 0; i < sizeof (vm->regs); i++)
+    h = (h ^ p[i]) * 16777619u;
+
+  return (h ^ yesod_flags (vm)) * 16777619u;
+}
+
+/*
+ * runs `path` once, in `ns` unless it is NULL, returns 1 if it did not
+ * halt
+ */
+static int
+run (path, engine, jit, checked, executed, ns, h)
+     const char		*path;
+     enum yesod_engine	engine;
+     bool		jit;
+     bool		checked;
+     uint64_t		*executed;
+     uint64_t		*ns;
+     uint32_t		*h;
+{
+  struct yesod_vm	vm;
+  struct yesod_stop	stop;
+  FILE			*f;
+  uint64_t		start;
+  int			err;
+
+  /* registers start at 0, as nothing else sets them */
+  memset (&vm, 0, sizeof (vm));
+  bench_quiet (true);
+  err = yesod_init_vm (&vm, MEMORY, STACK_SIZE);
+
+  if (!err)
+    {
+      vm.tlb.enabled = checked;
+      vm.jit.enabled = jit;
+      vm.engine = engine;
+
+      f = fopen (path, "rb");
+      err = !f || yesod_init_prog (&vm, f);
+
+      if (f)
+	fclose (f);
+    }
+
+  bench_quiet (false);
+
+  if (err)
+    {
+      fprintf (stderr, "mips: could not load %s\n", path);
+      return 1;
+    }
+
+  start = bench_now ();
+  stop = yesod_run (&vm, YESOD_UNLIMITED);
+
+  if (ns)
+    *ns = bench_now () - start;
+
+  *executed = stop.executed;
+  *h = hash (&vm);
+
+  yesod_destroy_vm (&vm);
+
+  if (stop.reason != YESOD_HALT)
+    {
+      fprintf (stderr, "mips: %s stopped by %s at %#010x\n", path,
+	       yesod_stop_name (stop.reason), stop.pc);
+      return 1;
+    }
+
+  return 0;
+}
+
+/* the name of `path`, without its directory and extension */
+static int
+name (path, len)
+     const char	*path;
+     int	*len;
+{
+  const char *base = strrchr (path, '/');
+
+  base = base ? base + 1 : path;
+  *len = strcspn (base, ".");
+
+  return base - path;
+}
+
+static int
+bench (path, engine, jit, checked)
+     const char		*path;
+     enum yesod_engine	engine;
+     bool		jit;
+     bool		checked;
+{
+  uint64_t	executed, expect, t[ROUNDS], low;
+  uint32_t	h, first;
+  double	mean = 0, var = 0;
+  int		i, at, len;
+
+  if (run (path, engine, jit, checked, &expect, NULL, &first))
+    return 1;
+
+  for (i = 0; i < ROUNDS; i++)
+    {
+      if (run (path, engine, jit, checked, &executed, &t[i], &h))
+	return 1;
+
+      if (executed != expect || h != first)
+	{
+	  fprintf (stderr, "mips: %s ran differently from its warm-up\n",
+		   path);
+	  return 1;
+	}
+    }
+
+  for (i = 0, low = t[0]; i < ROUNDS; i++)
+    {
+      mean += (double)t[i] / ROUNDS;
+      low = t[i] < low ? t[i] : low;
+    }
+
+  for (i = 0; i < ROUNDS; i++)
+    var += ((double)t[i] - mean) * ((double)t[i] - mean) / ROUNDS;
+
+  at = name (path, &len);
+  printf ("%-10.*s %12lu %10.3f %10.3f %10.3f %9.1f  %08x\n", len,
+	  path + at, (unsigned long)expect, mean / 1e6, (double)low / 1e6,
+	  sqrt (var) / 1e6, (double)expect * 1e3 / mean, first);
+
+  return 0;
+}
+
+int
+main (argc, argv)
+     int argc;
+     char *const argv[];
+{
+  enum yesod_engine	engine = YESOD_ENGINE_SWITCH;
+  bool			jit = true, checked = false;
+  int			opt;
+
+  while ((opt = getopt (argc, argv, "JMt")) != -1)
+    {
+      switch (opt)
+	{
+	case 'J':
+	  jit = false;
+	  break;
+	case 'M':
+	  checked = true;
+	  break;
+	case 't':
+	  engine = YESOD_ENGINE_THREADED;
+	  break;
+	default:
+	  fprintf (stderr, "usage: %s [-J] [-M] [-t] file...\n", argv[0]);
+	  return EXIT_FAILURE;
+	}
+    }
+
+  if (optind >= argc)
+    {
+      fprintf (stderr, "usage: %s [-J] [-M] [-t] file...\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  printf ("%u rounds, %s engine%s, %s mode\n", ROUNDS,
+	  engine == YESOD_ENGINE_THREADED ? "threaded" : "switch",
+	  engine == YESOD_ENGINE_THREADED && !jit ? " without the JIT" : "",
+	  checked ? "checked" : "unchecked");
+  printf ("%-10s %12s %10s %10s %10s %9s  %8s\n", "program",
+	  "instructions", "mean ms", "min ms", "stddev ms", "MIPS",
+	  "state");
+
+  for (; optind < argc; optind++)
+    if (bench (argv[optind], engine, jit, checked))
+      return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,210 @@
+/*
+ * guest benchmark programs
+ *
+ * writes the YSWD binaries bench/mips times, each running one of the
+ * hot paths of the VM in a loop: `bench/programs bench/arith.yswd`
+ * writes the program named after the file. all of them halt, and need
+ * a stack of 1 MB, as bench/mips runs them, and end with the same
+ * registers in checked mode (see tlb.h) as without it
+ *
+ * flags only ever get set (see flags.h), so a loop runs once: x9
+ * counts up from 2^31 - n and the loop ends on the overflow of its
+ * last increment, x8 holding 1 and x5 0xFFFF for backward jumps
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+
+#define HI(x) ((uint32_t)(x) >> 16)
+#define LO(x) ((uint32_t)(x) & 0xFFFF)
+
+/* x9 = 2^31 - n, along with x8 and x5 */
+#define COUNT(n)							\
+  C2 (MOV, 8, 1),							\
+  C2 (MOV, 5, 0xFFFF),							\
+  C2 (MOV, 9, LO (0x80000000 - (n))),					\
+  C2U (OR, 9, HI (0x80000000 - (n)))
+
+/* ends a loop of `n` words, this one included */
+#define LOOP(n)								\
+  C1 (ADD, 9, 8),							\
+  C4 (JR, 5, -4 * ((n) - 1), LTS)
+
+/* ALU operations on registers */
+static const uint32_t arith[] = {
+  COUNT (1 << 19),
+  C2 (MOV, 2, 3),
+  C2 (MOV, 3, 0x55),
+  C2 (MOV, 7, 0xFFFF),
+  C1 (ADD, 1, 2),
+  C1 (XOR, 3, 1),
+  C1 (OR, 4, 3),
+  C1 (SUB, 6, 2),
+  C1 (AND, 7, 3),
+  C1 (MOV, 10, 6),
+  LOOP (8),
+  C1 (HLT, 0, 0)
+};
+
+/*
+ * traversals of a ring of 4096 cells, consed by the CONS service (see
+ * service.h): x6 is the first cell, whose cdr is set to the last one
+ * once they all are. the consing loop ends on carry, which x11 - x13
+ * sets once x13 is 0
+ */
+static const uint32_t traverse[] = {
+  COUNT (1 << 19),
+  C2 (MOV, 12, 0xFFFF),
+  C2 (MOV, 11, 1),
+  C2 (MOV, 13, LO (-4095)),
+  C2U (OR, 13, HI (-4095)),
+  C2 (MOV, 2, 0),
+  C4P (JA, 12, 0xF000, ALW),
+  C1 (MOV, 6, 1),
+  C1 (MOV, 7, 1),
+  C1 (MOV, 1, 13),
+  C1 (MOV, 2, 7),
+  C4P (JA, 12, 0xF000, ALW),
+  C1 (MOV, 7, 1),
+  C2 (ADD, 13, 1),
+  C1 (CMP, 11, 13),
+  C4 (JR, 5, -24, GEU),
+  C2 (ADD, 6, 4),
+  C1 (STR, 6, 7),
+  C1 (CAR, 1, 7),
+  C1 (XOR, 10, 1),
+  C1 (CDR, 7, 7),
+  LOOP (5),
+  C1 (HLT, 0, 0)
+};
+
+/*
+ * recursion 2^17 calls deep, a call returning by popping its return
+ * address into x1 and jumping to it. the deepest one returns at once
+ */
+static const uint32_t calls[] = {
+  COUNT (1 << 17),
+  C4P (JR, 0, 8, ALW),
+  C1 (HLT, 0, 0),
+  C1 (ADD, 9, 8),		/* function */
+  C4 (JR, 0, 8, GES),
+  C4P (JR, 5, -8, ALW),
+  C2 (SUB, 15, 4),		/* return */
+  C1 (CAR, 1, 15),
+  C3 (JA, 1, ALW)
+};
+
+/* stores of words, 4 at a time, to the first 256 kB of the stack */
+static const uint32_t fill[] = {
+  COUNT (1 << 18),
+  C2 (MOV, 4, 0xFFF0),
+  C2U (OR, 4, 3),
+  C1 (MOV, 13, 7),
+  C1 (STR, 13, 9),
+  C2 (ADD, 13, 4),
+  C1 (STR, 13, 9),
+  C2 (ADD, 13, 4),
+  C1 (STR, 13, 9),
+  C2 (ADD, 13, 4),
+  C1 (STR, 13, 9),
+  C2 (ADD, 7, 16),
+  C1 (AND, 7, 4),
+  LOOP (12),
+  C1 (HLT, 0, 0)
+};
+
+/* shifts by immediates and registers, and accesses of every size */
+static const uint32_t shifts[] = {
+  COUNT (1 << 18),
+  C2 (MOV, 6, 3),
+  C2 (MOV, 7, 0x100),
+  C1S (MOV, 1, 9, LSL, 3),
+  C1S (XOR, 2, 1, LSR, 2),
+  C1S (OR, 3, 9, ASR, 5),
+  C1R (XOR, 4, 9, LSL, 6),
+  C1Z (STR, 7, 1, BYTE),
+  C1Z (STR, 7, 2, HALF),
+  C1Z (CAR, 10, 7, HALF),
+  C1Z (CDR, 11, 7, DAY),
+  LOOP (10),
+  C1 (HLT, 0, 0)
+};
+
+#define WORDS(a) (sizeof (a) / sizeof (*(a)))
+
+static const struct {
+  const char		*name;
+  const uint32_t	*text;
+  uint32_t		words;
+} programs[] = {
+  { "arith", arith, WORDS (arith) },
+  { "traverse", traverse, WORDS (traverse) },
+  { "calls", calls, WORDS (calls) },
+  { "fill", fill, WORDS (fill) },
+  { "shifts", shifts, WORDS (shifts) }
+};
+
+/* writes the program `path` is named after */
+static int
+emit (path)
+     const char *path;
+{
+  const char	*name = strrchr (path, '/');
+  uint8_t	*p;
+  size_t	length, n;
+  FILE		*f;
+  uint32_t	i;
+
+  name = name ? name + 1 : path;
+  n = strcspn (name, ".");
+
+  for (i = 0; i < WORDS (programs); i++)
+    if (strlen (programs[i].name) == n && !strncmp (name, programs[i].name, n))
+      break;
+
+  if (i == WORDS (programs))
+    {
+      fprintf (stderr, "programs: no program %.*s\n", (int)n, name);
+      return 1;
+    }
+
+  p = bench_image (programs[i].text, programs[i].words, NULL, 0, &length);
+  f = p ? fopen (path, "wb") : NULL;
+
+  if (!f || fwrite (p, length, 1, f) != 1)
+    {
+      perror ("programs");
+      free (p);
+
+      if (f)
+	fclose (f);
+
+      return 1;
+    }
+
+  free (p);
+
+  return fclose (f) ? 1 : 0;
+}
+
+int
+main (argc, argv)
+     int argc;
+     char *const argv[];
+{
+  int i;
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "usage: %s program.yswd...\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  for (i = 1; i < argc; i++)
+    if (emit (argv[i]))
+      return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,207 @@
+/*
+ * type dispatch benchmark
+ *
+ * runs the inner loop of an interpreter for yesod over a list of
+ * ELEMENTS values, ROUNDS times: fixnums are summed, so are the cars
+ * of conses, and symbols are counted. values are tagged in their 2 low
+ * bits (see tags.h), and the list ends with a symbol
+ *
+ * the software version dispatches through a jump table indexed by the
+ * tag it masks off, the tagged one runs in tagged mode and tests tags
+ * with CMP and JR.TAG
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm.h"
+#include "run.h"
+#include "bench.h"
+
+#ifndef ELEMENTS
+# define ELEMENTS (1 << 20)
+#endif
+
+#ifndef ROUNDS
+# define ROUNDS (10)
+#endif
+
+#define MEMORY (32 << 20)
+
+#define CONS   (0)
+#define FIXNUM (1)
+#define SYMBOL (2)
+
+/* x7 runs through the list, x5 holds 0xFFFF for backward jumps */
+static const uint32_t software[] = {
+  C1 (CAR, 1, 7),
+  C1 (MOV, 2, 1),
+  C2 (AND, 2, 3),
+  C1S (MOV, 3, 2, LSL, 2),
+  C2 (ADD, 3, 4),
+  C3 (JR, 3, ALW),
+  C4 (JR, 0, 24, ALW),		/* cons */
+  C4 (JR, 0, 12, ALW),		/* fixnum */
+  C4 (JR, 0, 28, ALW),		/* symbol */
+  C4 (JR, 0, 24, ALW),
+  C1 (ADD, 10, 1),		/* fixnum */
+  C4 (JR, 0, 20, ALW),
+  C1 (CAR, 4, 1),		/* cons */
+  C1 (ADD, 10, 4),
+  C4 (JR, 0, 8, ALW),
+  C2 (ADD, 11, 1),		/* symbol */
+  C1 (CDR, 7, 7),		/* next */
+  /* flags only ever get set: carry is first set once x7 < 3 */
+  C1 (CMP, 6, 7),
+  C4 (JR, 5, -72, GEU),
+  C1 (HLT, 0, 0)
+};
+
+static const uint32_t tagged[] = {
+  C1 (CAR, 1, 7),
+  C2 (CMP, 1, FIXNUM),
+  C4 (JR, 0, 20, TAG),
+  C2 (CMP, 1, CONS),
+  C4 (JR, 0, 20, TAG),
+  C2 (ADD, 11, 1),		/* symbol */
+  C4 (JR, 0, 20, ALW),
+  C1 (ADD, 10, 1),		/* fixnum */
+  C4 (JR, 0, 12, ALW),
+  C1 (CAR, 4, 1),		/* cons */
+  C1 (ADD, 10, 4),
+  C1 (CDR, 7, 7),		/* next */
+  C2 (CMP, 7, CONS),
+  C4 (JR, 5, -52, TAG),
+  C1 (HLT, 0, 0)
+};
+
+/* the list, 0 if the heap is short */
+static uint32_t
+build (vm)
+     struct yesod_vm *vm;
+{
+  uint32_t list = SYMBOL, x, i = ELEMENTS;
+
+  while (i--)
+    {
+      x = i << 2 | FIXNUM;
+
+      if (i % 4 == 2)
+	x = yesod_heap_cons (vm, x, SYMBOL);
+      else if (i % 4 == 3)
+	x = i << 2 | SYMBOL;
+
+      if (!x || !(list = yesod_heap_cons (vm, x, list)))
+	return 0;
+    }
+
+  return vm->cons.collections ? 0 : list;
+}
+
+static int
+bench (name, text, words, bits, engine)
+     const char		*name;
+     const uint32_t	*text;
+     uint32_t		words;
+     uint8_t		bits;
+     enum yesod_engine	engine;
+{
+  struct yesod_vm	vm;
+  struct yesod_stop	stop;
+  FILE			*f = NULL;
+  uint8_t		*p;
+  size_t		length;
+  uint32_t		list, sum = 0, symbols = 0, i;
+  uint64_t		start, t = 0, executed = 0;
+
+  p = bench_image (text, words, NULL, 0, &length);
+
+  if (!p || yesod_init_vm (&vm, MEMORY, 128))
+    {
+      free (p);
+      return 1;
+    }
+
+  vm.tags.bits = bits;
+  vm.engine = engine;
+
+  f = fmemopen (p, length, "r");
+
+  if (!f || yesod_init_prog (&vm, f) || !(list = build (&vm)))
+    {
+      if (f)
+	fclose (f);
+
+      free (p);
+      yesod_destroy_vm (&vm);
+
+      return 1;
+    }
+
+  fclose (f);
+  free (p);
+
+  for (i = 0; i < ELEMENTS; i++)
+    {
+      if (i % 4 == 3)
+	symbols++;
+      else
+	sum += i << 2 | FIXNUM;
+    }
+
+  for (i = 0; i < ROUNDS; i++)
+    {
+      memset (vm.regs, 0, sizeof (vm.regs));
+      vm.regs[5] = 0xFFFF;
+      vm.regs[6] = 3;
+      vm.regs[7] = list;
+      vm.regs[PC] = vm.text;
+      yesod_flags (&vm);
+      vm.flags = 0;
+
+      start = bench_now ();
+      stop = yesod_run (&vm, YESOD_UNLIMITED);
+      t += bench_now () - start;
+      executed += stop.executed;
+
+      if (stop.reason != YESOD_HALT || vm.regs[10] != sum
+	  || vm.regs[11] != symbols)
+	{
+	  fprintf (stderr, "tags: %s stopped by %s at %#010x\n", name,
+		   yesod_stop_name (stop.reason), stop.pc);
+	  yesod_destroy_vm (&vm);
+
+	  return 1;
+	}
+    }
+
+  printf ("%-9s %-9s %8.2f %10.1f %10.2f\n", name,
+	  engine == YESOD_ENGINE_THREADED ? "threaded" : "switch",
+	  (double)executed / ((double)ELEMENTS * ROUNDS),
+	  (double)ELEMENTS * ROUNDS * 1e3 / t,
+	  (double)t / ((double)ELEMENTS * ROUNDS));
+
+  yesod_destroy_vm (&vm);
+
+  return 0;
+}
+
+#define WORDS(a) (sizeof (a) / sizeof (*(a)))
+
+int
+main ()
+{
+  int err;
+
+  printf ("%u elements, %u rounds\n", ELEMENTS, ROUNDS);
+  printf ("%-9s %-9s %8s %10s %10s\n",
+	  "dispatch", "engine", "ins/elt", "Melt/s", "ns/elt");
+
+  err = bench ("software", software, WORDS (software), 0, YESOD_ENGINE_SWITCH)
+    || bench ("tagged", tagged, WORDS (tagged), 2, YESOD_ENGINE_SWITCH)
+    || bench ("software", software, WORDS (software), 0,
+	      YESOD_ENGINE_THREADED)
+    || bench ("tagged", tagged, WORDS (tagged), 2, YESOD_ENGINE_THREADED);
+
+  return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
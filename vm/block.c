@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include "block.h"
+#include "handler.h"
+#include "vm.h"
+
+int
+yesod_blocks_init (vm)
+     struct yesod_vm *vm;
+{
+  struct yesod_blocks	*c = &vm->blocks;
+  uint32_t		n = 1;
+
+  if (!c->capacity)
+    c->capacity = 1;
+
+  /* at least two table entries per block */
+  while (n < 2 * c->capacity)
+    n <<= 1;
+
+  c->ring = calloc (c->capacity, sizeof (struct yesod_block));
+  c->table = calloc (n, sizeof (struct yesod_block *));
+
+  if (!c->ring || !c->table)
+    {
+      yesod_blocks_destroy (vm);
+      return 1;
+    }
+
+  c->mask = n - 1;
+  c->head = 0;
+  c->last_id = 0;
+  c->scratch.id = 0;
+  c->scratch.hits = 0;
+  c->scratch.native = NULL;
+  c->translated = c->evicted = c->flushed = c->fused = 0;
+
+  return 0;
+}
+
+#define HASH(c, pc) (((pc) >> 2) & (c)->mask)
+
+/* true if the instruction leaves the straight-line path */
+bool
+yesod_block_ends (op)
+     const struct yesod_op *op;
+{
+  switch (op->class)
+    {
+    case INSTR_CLASS1:
+      switch (op->opcode)
+	{
+	case MOV:
+	case ADD:
+	case SUB:
+	case AND:
+	case OR:
+	case XOR:
+	case CAR:
+	case CDR:
+	  return op->ra == PC;
+	case NOP:
+	case STR:
+	case CMP:
+	  return false;
+	default:
+	  return true;
+	}
+    case INSTR_CLASS2:
+      switch (op->opcode)
+	{
+	case MOV:
+	case ADD:
+	case SUB:
+	case AND:
+	case OR:
+	case XOR:
+	case CAR:
+	case CDR:
+	  return op->ra == PC;
+	case STR:
+	case CMP:
+	  return false;
+	default:
+	  return true;
+	}
+    case INSTR_CLASS3:
+    case INSTR_CLASS4:
+      return true;
+    }
+
+  return true;
+}
+
+/* handler running `a` and `b` at once, or 0 if they do not fuse */
+static uint16_t
+fuse (a, b)
+     const struct yesod_op *a, *b;
+{
+  if (YESOD_HANDLER_CC (a->handler))
+    return 0;
+
+  if (a->class == INSTR_CLASS2 && a->opcode == MOV && (a->bits & OP_UPLO)
+      && b->class == INSTR_CLASS2 && b->opcode == OR && !(b->bits & OP_UPLO)
+      && !YESOD_HANDLER_CC (b->handler) && a->ra == b->ra && a->ra
+      && a->ra != PC)
+    return YESOD_FUSED_CONST;
+
+  if (a->opcode != CMP
+      || (a->class == INSTR_CLASS1 && (a->shift != NONE || a->size != WORD))
+      || (a->class == INSTR_CLASS2 && (a->bits & OP_UPLO)))
+    return 0;
+
+  if ((b->opcode != JA && b->opcode != JR) || (b->bits & OP_PUSH)
+      || (b->class == INSTR_CLASS3 && (b->shift != NONE || b->size != WORD)))
+    return 0;
+
+  switch (b->class)
+    {
+    case INSTR_CLASS3:
+    case INSTR_CLASS4:
+      return YESOD_FUSED_CMP (a->class, b->class, b->opcode);
+    }
+
+  return 0;
+}
+
+static void
+translate (vm, b, pc)
+     struct yesod_vm	*vm;
+     struct yesod_block	*b;
+     uint32_t		pc;
+{
+  const struct yesod_op	*op;
+  uint32_t		n;
+
+  b->pc = pc;
+  b->hits = 0;
+  b->native = NULL;
+  b->next[0].block = b->next[1].block = NULL;
+
+  for (n = 0; n < YESOD_BLOCK_MAX; n++, pc += 4)
+    {
+      if (!YESOD_PREDECODED (vm, pc) || !YESOD_PREDECODED (vm, pc + 3))
+	break;
+
+      op = yesod_predecode_fill (vm, pc);
+      b->ops[n] = *op;
+
+      if (yesod_block_ends (op))
+	{
+	  n++;
+	  break;
+	}
+    }
+
+  b->len = n;
+
+  /*
+   * the second instruction of a pair keeps its handler, for when the
+   * pair is split by the budget or by the native code of the block
+   */
+  for (n = 0; n + 1 < b->len; n++)
+    {
+      uint16_t h = fuse (&b->ops[n], &b->ops[n + 1]);
+
+      if (h)
+	{
+	  b->ops[n++].handler = h;
+	  vm->blocks.fused++;
+	}
+    }
+}
+
+/*
+ * returns the block starting at `pc`, translating it if needed
+ *
+ * translating a block may evict any other one
+ */
+struct yesod_block *
+yesod_block_lookup (vm, pc)
+     struct yesod_vm	*vm;
+     uint32_t		pc;
+{
+  struct yesod_blocks	*c = &vm->blocks;
+  struct yesod_block	*b;
+
+  if (!YESOD_PREDECODED (vm, pc) || ((pc - vm->decoded.base) & 3))
+    {
+      b = &c->scratch;
+      b->pc = pc;
+      b->len = 1;
+
+      /*
+       * the engine runs services, and in checked mode faults, before
+       * running it
+       */
+      if (YESOD_SERVICE (vm, pc)
+	  || (vm->tlb.enabled && yesod_tlb_fetch (vm, pc)))
+	b->ops[0] = yesod_predecode (0);
+      else
+	b->ops[0] = yesod_predecode (yesod_fetch (vm, pc));
+
+      return b;
+    }
+
+  b = c->table[HASH (c, pc)];
+
+  if (b && b->id && b->pc == pc)
+    return b;
+
+  b = &c->ring[c->head];
+
+  if (b->id)
+    {
+      if (c->table[HASH (c, b->pc)] == b)
+	c->table[HASH (c, b->pc)] = NULL;
+
+      c->evicted++;
+    }
+
+  c->head = (c->head + 1) % c->capacity;
+
+  /* 0 marks free slots */
+  if (!++c->last_id)
+    ++c->last_id;
+
+  b->id = c->last_id;
+  translate (vm, b, pc);
+  c->table[HASH (c, pc)] = b;
+  c->translated++;
+
+  return b;
+}
+
+/* drops every block, for when .text is written to */
+void
+yesod_blocks_flush (vm)
+     struct yesod_vm *vm;
+{
+  struct yesod_blocks	*c = &vm->blocks;
+  uint32_t		i;
+
+  for (i = 0; i < c->capacity; i++)
+    c->ring[i].id = 0;
+
+  for (i = 0; i <= c->mask; i++)
+    c->table[i] = NULL;
+
+  c->head = 0;
+  c->flushed++;
+}
+
+void
+yesod_blocks_destroy (vm)
+     struct yesod_vm *vm;
+{
+  free (vm->blocks.ring);
+  free (vm->blocks.table);
+
+  vm->blocks.ring = NULL;
+  vm->blocks.table = NULL;
+}
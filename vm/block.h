@@ -0,0 +1,84 @@
+#ifndef YESOD_BLOCK_
+# define YESOD_BLOCK_
+
+# include <stdbool.h>
+# include <stdint.h>
+# include "decoder.h"
+# include "jit.h"
+
+struct yesod_vm;
+
+/* longest straight-line run translated into a single block */
+# define YESOD_BLOCK_MAX (32)
+
+/* number of blocks kept by default */
+# define YESOD_BLOCKS_DEFAULT (1024)
+
+struct yesod_block;
+
+/*
+ * chained successor of a block
+ *
+ * the link holds as long as the block it points to still has the id
+ * it had when the link was made
+ */
+struct yesod_link {
+  uint32_t		pc;
+  uint32_t		id;
+  struct yesod_block	*block;
+};
+
+# define YESOD_CHAINED(l, a) \
+  ((l).pc == (a) && (l).block && (l).block->id == (l).id)
+
+/*
+ * translated basic block
+ *
+ * a block starts at `pc` and runs straight through `len` instructions,
+ * the last of which is a jump (III, IV), HLT, a write to x14 or simply
+ * the YESOD_BLOCK_MAXth one. `next[0]` chains to the block run when
+ * falling through the end, `next[1]` to the last jump target taken.
+ * `native` is set once the block ran `YESOD_JIT_THRESHOLD` times.
+ * pairs of instructions that run as one have the first one's handler
+ * replaced with a fused one
+ */
+struct yesod_block {
+  uint32_t		pc;
+  uint32_t		id;	/* 0 if the slot is free */
+  uint32_t		len;
+  uint32_t		hits;
+  yesod_native		native;
+  struct yesod_link	next[2];
+  struct yesod_op	ops[YESOD_BLOCK_MAX];
+};
+
+/*
+ * translation cache
+ *
+ * blocks live in a ring of `capacity` slots, the oldest block being
+ * evicted once the ring is full. `table` maps a pc to its block,
+ * collisions simply replacing the previous entry. blocks outside of
+ * .text are translated into `scratch` every time they run
+ */
+struct yesod_blocks {
+  uint32_t		capacity;
+  uint32_t		head;
+  uint32_t		mask;
+  uint32_t		last_id;
+  struct yesod_block	*ring;
+  struct yesod_block	**table;
+  struct yesod_block	scratch;
+
+  uint64_t		translated;
+  uint64_t		evicted;
+  uint64_t		flushed;
+  uint64_t		fused;		/* pairs of instructions, see handler.h */
+};
+
+int			yesod_blocks_init (struct yesod_vm *);
+struct yesod_block	*yesod_block_lookup (struct yesod_vm *, uint32_t);
+void			yesod_blocks_flush (struct yesod_vm *);
+bool			yesod_block_ends (const struct yesod_op *);
+void			yesod_blocks_destroy (struct yesod_vm *);
+
+#endif /* YESOD_BLOCK_ */
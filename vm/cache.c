@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+#include "vm.h"
+
+static const char *const policies[] = { "lru", "fifo", "random" };
+
+/*
+ * reads `size:ways:line[:policy]` into `c`, the policy being lru,
+ * fifo or random, lru by default. returns 1 if it is malformed
+ */
+int
+yesod_cache_parse (c, spec)
+     struct yesod_cache	*c;
+     const char		*spec;
+{
+  char		*end;
+  uint32_t	i;
+
+  c->size = strtoul (spec, &end, 10);
+
+  if (*end == ':')
+    c->ways = strtoul (end + 1, &end, 10);
+
+  if (*end == ':')
+    c->line = strtoul (end + 1, &end, 10);
+
+  c->policy = YESOD_POLICY_LRU;
+
+  if (*end == ':')
+    {
+      for (i = 0; i < sizeof (policies) / sizeof (*policies); i++)
+	if (!strcmp (end + 1, policies[i]))
+	  break;
+
+      if (i == sizeof (policies) / sizeof (*policies))
+	{
+	  fprintf (stderr, "yesod: unknown replacement policy %s\n", end + 1);
+	  return 1;
+	}
+
+      c->policy = (enum yesod_policy)i;
+      end += strlen (end);
+    }
+
+  if (*end)
+    {
+      fprintf (stderr, "yesod: malformed cache %s, expected size:ways:line[:policy]\n",
+	       spec);
+      return 1;
+    }
+
+  return 0;
+}
+
+#define POWER_OF_2(x) ((x) && !((x) & ((x) - 1)))
+
+/* sets `c` up once the program is loaded, returns 1 on error */
+int
+yesod_cache_init (vm, c)
+     struct yesod_vm	*vm;
+     struct yesod_cache	*c;
+{
+  c->tags = NULL;
+  c->stamps = c->pcs = NULL;
+  c->tick = c->hits = c->misses = c->evictions = 0;
+  c->seed = 0x9E3779B9;
+
+  if (!c->size)
+    return 0;
+
+  if (!POWER_OF_2 (c->size) || !POWER_OF_2 (c->ways) || !POWER_OF_2 (c->line)
+      || c->line < 4 || c->size < c->ways * c->line)
+    {
+      fprintf (stderr, "yesod: a cache of %u bytes cannot have %u ways of %u byte lines\n",
+	       c->size, c->ways, c->line);
+      return 1;
+    }
+
+  c->sets = c->size / c->line / c->ways;
+
+  for (c->bits = 0; (1u << c->bits) < c->line; c->bits++)
+    ;
+
+  c->base = vm->decoded.base;
+  c->words = vm->decoded.size / 4;
+  c->tags = calloc (c->sets * c->ways, sizeof (*c->tags));
+  c->stamps = calloc (c->sets * c->ways, sizeof (*c->stamps));
+  c->pcs = calloc (c->words + 1, sizeof (*c->pcs));
+
+  if (!c->tags || !c->stamps || !c->pcs)
+    {
+      fprintf (stderr, "yesod: could not allocate the cache model\n");
+      return 1;
+    }
+
+  return 0;
+}
+
+/* the way of the set at `w` to fill */
+static uint32_t
+victim (c, w)
+     struct yesod_cache	*c;
+     uint32_t		w;
+{
+  uint32_t i, v = w;
+
+  for (i = w; i < w + c->ways; i++)
+    {
+      if (!c->tags[i])
+	return i;
+
+      if (c->stamps[i] < c->stamps[v])
+	v = i;
+    }
+
+  if (c->policy == YESOD_POLICY_RANDOM)
+    {
+      /* xorshift32 */
+      c->seed ^= c->seed << 13;
+      c->seed ^= c->seed >> 17;
+      c->seed ^= c->seed << 5;
+      v = w + (c->seed & (c->ways - 1));
+    }
+
+  return v;
+}
+
+/* the slow path of YESOD_CACHE */
+void
+yesod_cache_access (c, a, len, pc)
+     struct yesod_cache	*c;
+     uint32_t		a;
+     uint32_t		len;
+     uint32_t		pc;
+{
+  uint32_t	line = a >> c->bits, last = (a + len - 1) >> c->bits;
+  uint32_t	w, i;
+  int		missed = 0;
+
+  /* accesses wrapping around memory fault, or are single bytes */
+  if (last < line)
+    last = line;
+
+  for (;; line++)
+    {
+      w = (line & (c->sets - 1)) * c->ways;
+
+      for (i = w; i < w + c->ways; i++)
+	if (c->tags[i] == line + 1)
+	  break;
+
+      if (i == w + c->ways)
+	{
+	  missed = 1;
+	  i = victim (c, w);
+
+	  if (c->tags[i])
+	    c->evictions++;
+
+	  c->tags[i] = line + 1;
+	  c->stamps[i] = ++c->tick;
+	}
+      else if (c->policy == YESOD_POLICY_LRU)
+	c->stamps[i] = ++c->tick;
+
+      if (line == last)
+	break;
+    }
+
+  if (!missed)
+    {
+      c->hits++;
+      return;
+    }
+
+  c->misses++;
+
+  /* misses out of .text go to the last slot */
+  if ((pc - c->base) / 4 < c->words)
+    c->pcs[(pc - c->base) / 4]++;
+  else
+    c->pcs[c->words]++;
+}
+
+/* prints the statistics of `c` and its instructions that miss most */
+void
+yesod_cache_dump (c, name)
+     const struct yesod_cache	*c;
+     const char			*name;
+{
+  uint32_t	worst[YESOD_CACHE_WORST], n, i;
+  uint64_t	total = c->hits + c->misses;
+
+  printf ("%s: %u bytes, %u ways of %u byte lines, %s\n", name, c->size,
+	  c->ways, c->line, policies[c->policy]);
+  printf ("  %lu hits, %lu misses (%.2f%%), %lu evictions\n",
+	  (unsigned long)c->hits, (unsigned long)c->misses,
+	  total ? 100.0 * c->misses / total : 0,
+	  (unsigned long)c->evictions);
+
+  /* most misses first, the last word counting those outside .text */
+  n = yesod_counters_top (c->pcs, c->words + 1, worst, YESOD_CACHE_WORST);
+
+  for (i = 0; i < n; i++)
+    {
+      if (worst[i] == c->words)
+	printf ("  %10s", "elsewhere");
+      else
+	printf ("  %#010x", c->base + 4 * worst[i]);
+
+      printf (" %lu misses\n", (unsigned long)c->pcs[worst[i]]);
+    }
+}
+
+void
+yesod_cache_destroy (c)
+     struct yesod_cache *c;
+{
+  free (c->tags);
+  free (c->stamps);
+  free (c->pcs);
+  c->tags = NULL;
+  c->stamps = c->pcs = NULL;
+}
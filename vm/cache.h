@@ -0,0 +1,72 @@
+#ifndef YESOD_CACHE_
+# define YESOD_CACHE_
+
+# include <stdint.h>
+
+struct yesod_vm;
+
+/* replacement policies */
+enum yesod_policy {
+  YESOD_POLICY_LRU,		/* least recently used */
+  YESOD_POLICY_FIFO,		/* first filled */
+  YESOD_POLICY_RANDOM
+};
+
+/* instructions whose misses `yesod_cache_dump` lists */
+# ifndef YESOD_CACHE_WORST
+#  define YESOD_CACHE_WORST (8)
+# endif
+
+/*
+ * model of a set-associative L1 cache
+ *
+ * `size` bytes in lines of `line` bytes, `ways` per set, all powers of
+ * 2. the model only keeps which lines are present, guest memory is
+ * still accessed directly. an access touches every line its bytes
+ * span, and counts as a single hit or miss, the miss being charged to
+ * the instruction at `pc` if it is in .text
+ *
+ * the I-cache sees the fetch of every instruction run, and the D-cache
+ * the loads of CAR and CDR, STR and pushes, with their sizes (see
+ * tlb.h). either is off as long as its `size` is 0, and with both off
+ * nothing is modelled. otherwise the VM runs with
+ * the switch engine, which the hooks are in
+ */
+struct yesod_cache {
+  uint32_t		size;
+  uint32_t		ways;
+  uint32_t		line;
+  enum yesod_policy	policy;
+
+  uint32_t		sets;
+  uint8_t		bits;		/* log2 of `line` */
+  uint32_t		*tags;		/* line number + 1 of each way, or 0 */
+  uint64_t		*stamps;	/* tick of last use (LRU) or fill (FIFO) */
+  uint64_t		tick;
+  uint32_t		seed;
+
+  uint32_t		base;		/* .text */
+  uint32_t		words;
+  uint64_t		*pcs;		/* misses of each word of .text */
+
+  uint64_t		hits;
+  uint64_t		misses;
+  uint64_t		evictions;
+};
+
+/* models the access of `len` bytes at `a`, by the instruction at `pc` */
+# define YESOD_CACHE(c, a, len, pc)					\
+  do									\
+    {									\
+      if ((c)->size)							\
+	yesod_cache_access ((c), (a), (len), (pc));			\
+    }									\
+  while (0)
+
+int	yesod_cache_parse (struct yesod_cache *, const char *);
+int	yesod_cache_init (struct yesod_vm *, struct yesod_cache *);
+void	yesod_cache_access (struct yesod_cache *, uint32_t, uint32_t, uint32_t);
+void	yesod_cache_dump (const struct yesod_cache *, const char *);
+void	yesod_cache_destroy (struct yesod_cache *);
+
+#endif /* YESOD_CACHE_ */
@@ -0,0 +1,82 @@
+#include <string.h>
+#include "cards.h"
+#include "vm.h"
+
+void
+yesod_cards_init (vm)
+     struct yesod_vm *vm;
+{
+  memset (&vm->cards, 0, sizeof (vm->cards));
+}
+
+/* true if the `len` bytes at `a` are writable, see tlb.h */
+static bool
+writable (vm, a, len)
+     struct yesod_vm	*vm;
+     uint32_t		a;
+     uint32_t		len;
+{
+  if (a + len < a)
+    return false;
+
+  if (vm->memory.protect && a < vm->memory.guard + vm->memory.page
+      && vm->memory.guard < a + len)
+    return false;
+
+  return a + len <= vm->rodata || (a >= vm->data && a + len <= vm->text);
+}
+
+/*
+ * marks the cards of the `size` bytes at `base` in the table at
+ * `table`, which is cleared, or stops marking if `size` is 0. returns
+ * the number of cards, 0 if the table would not be writable or would
+ * overlap the old generation
+ */
+uint32_t
+yesod_cards_set (vm, base, size, table)
+     struct yesod_vm	*vm;
+     uint32_t		base;
+     uint32_t		size;
+     uint32_t		table;
+{
+  struct yesod_cards	*c = &vm->cards;
+  uint32_t		n = YESOD_CARDS (size);
+
+  c->base = c->size = c->table = 0;
+
+  /* native code checks stores against the cards it was compiled with */
+  yesod_jit_flush (vm);
+
+  if (!size || base + size < base || base + size > vm->memory.m_size
+      || !writable (vm, table, n)
+      || (table < base + size && base < table + n))
+    return 0;
+
+  memset (vm->memory.memory + table, 0, n);
+  c->base = base;
+  c->size = size;
+  c->table = table;
+
+  return n;
+}
+
+/* the number of dirty cards */
+uint32_t
+yesod_cards_scan (vm)
+     struct yesod_vm *vm;
+{
+  struct yesod_cards	*c = &vm->cards;
+  const uint8_t		*t = vm->memory.memory + c->table;
+  uint32_t		n = YESOD_CARDS (c->size), dirty = 0, i;
+
+  for (i = 0; i < n; i++)
+    dirty += !!t[i];
+
+  c->scans++;
+  c->dirty += dirty;
+
+  if (dirty > c->max_dirty)
+    c->max_dirty = dirty;
+
+  return dirty;
+}
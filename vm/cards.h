@@ -0,0 +1,59 @@
+#ifndef YESOD_CARDS_
+# define YESOD_CARDS_
+
+# include <stdint.h>
+
+struct yesod_vm;
+
+/* bytes covered by a card, as a power of 2 */
+# ifndef YESOD_CARD_BITS
+#  define YESOD_CARD_BITS (9)
+# endif
+
+/* value of a card written to since it was cleared */
+# define YESOD_CARD_DIRTY (1)
+
+/*
+ * card marking, for the generational collectors of guests
+ *
+ * the old generation, `size` bytes from `base`, is split into cards of
+ * 1 << YESOD_CARD_BITS bytes, each with a byte of the guest table at
+ * `table`. every STR into the old generation sets the byte of the card
+ * holding its first byte to YESOD_CARD_DIRTY, so that a minor
+ * collection only has to look through the dirty cards for pointers to
+ * the young generation, clearing them to 0 as it goes
+ *
+ * guests set the table up and count its dirty cards through services,
+ * see service.h. marking is off as long as `size` is 0, in which case
+ * no store is ever in the old generation
+ */
+struct yesod_cards {
+  uint32_t	base;
+  uint32_t	size;
+  uint32_t	table;
+
+  uint64_t	marks;		/* stores that marked a card */
+  uint64_t	scans;
+  uint64_t	dirty;		/* dirty cards counted by the scans */
+  uint32_t	max_dirty;
+};
+
+/* cards of `size` bytes */
+# define YESOD_CARDS(size)						\
+  (((size) >> YESOD_CARD_BITS) + !!((size) & ((1 << YESOD_CARD_BITS) - 1)))
+
+/* true if a store to `a` marks a card */
+# define YESOD_CARD(vm, a)						\
+  ((uint32_t)((a) - (vm)->cards.base) < (vm)->cards.size)
+
+/* marks the card of `a`, in the old generation */
+# define YESOD_CARD_MARK(vm, a)						\
+  ((vm)->memory.memory[(vm)->cards.table				\
+		       + (((a) - (vm)->cards.base) >> YESOD_CARD_BITS)]	\
+   = YESOD_CARD_DIRTY, (vm)->cards.marks++)
+
+void		yesod_cards_init (struct yesod_vm *);
+uint32_t	yesod_cards_set (struct yesod_vm *, uint32_t, uint32_t, uint32_t);
+uint32_t	yesod_cards_scan (struct yesod_vm *);
+
+#endif /* YESOD_CARDS_ */
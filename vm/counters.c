@@ -0,0 +1,146 @@
+#include <string.h>
+#include "counters.h"
+#include "vm.h"
+
+/* maps the counter page, if it can be, once the program is loaded */
+void
+yesod_counters_init (vm)
+     struct yesod_vm *vm;
+{
+  struct yesod_counters *c = &vm->counters;
+
+  memset (c, 0, sizeof (*c));
+  c->heap = vm->heap;
+  c->page = vm->memory.m_size <= YESOD_COUNTER_PAGE
+    && !yesod_mem_open (&vm->memory, YESOD_COUNTER_PAGE, 0x1000);
+}
+
+uint64_t
+yesod_counters_read (vm, i)
+     struct yesod_vm		*vm;
+     enum yesod_counter		i;
+{
+  struct yesod_counters *c = &vm->counters;
+
+  switch (i)
+    {
+    case YESOD_COUNT_RETIRED:
+      return c->retired;
+    case YESOD_COUNT_TAKEN:
+      return c->taken;
+    case YESOD_COUNT_NOT_TAKEN:
+      return c->not_taken;
+    case YESOD_COUNT_PUSHES:
+      return c->pushes;
+    case YESOD_COUNT_READS:
+      return c->reads;
+    case YESOD_COUNT_WRITES:
+      return c->writes;
+    case YESOD_COUNT_STACK:
+      return c->sp - STACK;
+    case YESOD_COUNT_HEAP:
+      return c->heap - vm->heap;
+    case YESOD_COUNTERS:
+      break;
+    }
+
+  return 0;
+}
+
+/* writes the counters to the counter page */
+void
+yesod_counters_sync (vm)
+     struct yesod_vm *vm;
+{
+  uint8_t	*p = vm->memory.memory + YESOD_COUNTER_PAGE;
+  uint64_t	x;
+  int		i;
+
+  if (!vm->counters.page)
+    return;
+
+  for (i = 0; i < YESOD_COUNTERS; i++, p += 8)
+    {
+      x = yesod_counters_read (vm, i);
+      YESOD_SET_LE32 (p, x);
+      YESOD_SET_LE32 (p + 4, x >> 32);
+    }
+}
+
+/* prints the counters as a JSON object */
+void
+yesod_counters_json (vm, f)
+     struct yesod_vm	*vm;
+     FILE		*f;
+{
+  int i;
+
+  fprintf (f, "{");
+
+  for (i = 0; i < YESOD_COUNTERS; i++)
+    fprintf (f, "%s\"%s\": %lu", i ? ", " : "", yesod_counter_name (i),
+	     (unsigned long)yesod_counters_read (vm, i));
+
+  fprintf (f, ", \"stack_size\": %u}\n", vm->memory.s_size);
+}
+
+/*
+ * fills `top` with the indices of the at most `most` greatest of the
+ * `n` counts, greatest first, leaving out the zeros. returns how many
+ * there are
+ */
+uint32_t
+yesod_counters_top (counts, n, top, most)
+     const uint64_t	*counts;
+     uint32_t		n;
+     uint32_t		*top;
+     uint32_t		most;
+{
+  uint32_t	found = 0, i, j;
+
+  for (i = 0; i < n; i++)
+    {
+      if (!counts[i]
+	  || (found == most && counts[i] <= counts[top[found - 1]]))
+	continue;
+
+      if (found < most)
+	found++;
+
+      for (j = found - 1; j && counts[top[j - 1]] < counts[i]; j--)
+	top[j] = top[j - 1];
+
+      top[j] = i;
+    }
+
+  return found;
+}
+
+const char *
+yesod_counter_name (i)
+     enum yesod_counter i;
+{
+  switch (i)
+    {
+    case YESOD_COUNT_RETIRED:
+      return "retired";
+    case YESOD_COUNT_TAKEN:
+      return "taken";
+    case YESOD_COUNT_NOT_TAKEN:
+      return "not_taken";
+    case YESOD_COUNT_PUSHES:
+      return "pushes";
+    case YESOD_COUNT_READS:
+      return "reads";
+    case YESOD_COUNT_WRITES:
+      return "writes";
+    case YESOD_COUNT_STACK:
+      return "stack_peak";
+    case YESOD_COUNT_HEAP:
+      return "heap_peak";
+    case YESOD_COUNTERS:
+      break;
+    }
+
+  return "unknown";
+}
@@ -0,0 +1,88 @@
+#ifndef YESOD_COUNTERS_
+# define YESOD_COUNTERS_
+
+# include <stdbool.h>
+# include <stdint.h>
+# include <stdio.h>
+
+struct yesod_vm;
+
+/* page of the counters, right below the service page (see service.h) */
+# define YESOD_COUNTER_PAGE (0xFFFFE000)
+
+/* counters, in the order of the page */
+enum yesod_counter {
+  YESOD_COUNT_RETIRED,		/* instructions run, or skipped */
+  YESOD_COUNT_TAKEN,		/* jumps taken */
+  YESOD_COUNT_NOT_TAKEN,	/* jumps falling through */
+  YESOD_COUNT_PUSHES,
+  YESOD_COUNT_READS,		/* loads of CAR and CDR */
+  YESOD_COUNT_WRITES,		/* STR and pushes */
+  YESOD_COUNT_STACK,		/* most bytes of stack in use, of `s_size` */
+  YESOD_COUNT_HEAP,		/* most bytes in use above `vm->heap` */
+  YESOD_COUNTERS
+};
+
+/*
+ * performance counters
+ *
+ * kept by every engine, in batches: the threaded engine counts the
+ * instructions it retires a block at a time, and branches and the
+ * stack pointer at the end of every block, and the switch engine
+ * after every jump. so a stack that grows and shrinks back within a
+ * block is missed. both count HLT as retired, but not an instruction
+ * that traps or faults. the heap extent is the highest byte stored
+ * to, or allocated by the cons heap, from `vm->heap` up to .rodata
+ *
+ * host code reads them through `yesod_counters_read`, and guests from
+ * the counter page, where counter `i` is a 64-bit little-endian word
+ * at offset 8 * i. the page is written whenever the COUNTERS service
+ * is called, and whenever `yesod_run` returns, and is only there if
+ * memory does not reach it and the address space could be reserved
+ * (see mem.h). it is read-only in checked mode
+ */
+struct yesod_counters {
+  bool		page;		/* whether the counter page is there */
+
+  uint64_t	retired;
+  uint64_t	taken;
+  uint64_t	not_taken;
+  uint64_t	pushes;
+  uint64_t	reads;
+  uint64_t	writes;
+  uint32_t	sp;		/* highest stack pointer seen */
+  uint32_t	heap;		/* first byte past the highest one used */
+};
+
+/* true if `a` is in the counter page */
+# define YESOD_COUNTED(vm, a)						\
+  ((uint32_t)((a) - YESOD_COUNTER_PAGE) < 0x1000 && (vm)->counters.page)
+
+/* accounts for the stack pointer `x` */
+# define YESOD_COUNT_SP(vm, x)						\
+  do									\
+    {									\
+      if ((x) > (vm)->counters.sp && (x) <= (vm)->memory.s_size + 4)	\
+	(vm)->counters.sp = (x);					\
+    }									\
+  while (0)
+
+/* accounts for a store or allocation up to `end`, excluded */
+# define YESOD_COUNT_HEAP(vm, a, end)					\
+  do									\
+    {									\
+      if ((end) > (vm)->counters.heap && (a) >= (vm)->heap		\
+	  && (a) < (vm)->rodata)					\
+	(vm)->counters.heap = (end);					\
+    }									\
+  while (0)
+
+void		yesod_counters_init (struct yesod_vm *);
+uint64_t	yesod_counters_read (struct yesod_vm *, enum yesod_counter);
+void		yesod_counters_sync (struct yesod_vm *);
+void		yesod_counters_json (struct yesod_vm *, FILE *);
+const char	*yesod_counter_name (enum yesod_counter);
+uint32_t	yesod_counters_top (const uint64_t *, uint32_t, uint32_t *,
+				    uint32_t);
+
+#endif /* YESOD_COUNTERS_ */
@@ -1,356 +1,251 @@
 #include "cycle.h"
 #include "decoder.h"
-
-static uint32_t
-fetch (vm)
-     struct yesod_vm *vm;
-{
-  uint32_t pc = vm->regs[PC];
-  uint8_t x0 = vm->memory.memory[pc];
-  uint8_t x1 = vm->memory.memory[pc + 1];
-  uint8_t x2 = vm->memory.memory[pc + 2];
-  uint8_t x3 = vm->memory.memory[pc + 3];
-  
-  return ((uint32_t)x0
-          | ((uint32_t)x1 << 8)
-          | ((uint32_t)x2 << 16)
-          | ((uint32_t)x3 << 24));
-}
+#include "handler.h"
 
 static bool
 check (vm, cond)
      struct yesod_vm    *vm;
      enum cond          cond;
 {
+  uint8_t flags;
+
+  if (cond == ALW)
+    return true;
+
+  if (cond == TAG)
+    return YESOD_TAG_MATCH (&vm->tags);
+
+  flags = yesod_flags (vm);
+
   switch (cond)
     {
     case ALW:
       return true;
     case NEQ:
-      return (vm->flags & FLAG_NIL);
+      return (flags & FLAG_NIL);
     case EEQ:
-      return !(vm->flags & FLAG_NIL);
+      return !(flags & FLAG_NIL);
     case LTU:
-      return (vm->flags & FLAG_CARRY);
+      return (flags & FLAG_CARRY);
     case GEU:
-      return !(vm->flags & FLAG_CARRY);
+      return !(flags & FLAG_CARRY);
     case LTS:
-      return !(vm->flags & FLAG_OVER);
+      return !(flags & FLAG_OVER);
     case GES:
-      return (vm->flags & FLAG_OVER);
+      return (flags & FLAG_OVER);
+    case TAG:
+      break;
     }
 
   return true;
 }
 
-static uint32_t
-shift (x, st, s)
-     uint32_t   x;
-     enum shift st;
-     uint8_t    s;
-{
-  switch (st)
-    {
-    case NONE:
-      return x;
-    case LSL:
-      return (x << (uint32_t)s);
-    case LSR:
-      return (x >> (uint32_t)s);
-    case ASR:
-      {
-	int32_t xs = (int32_t)x >> s;
-	return (*(uint32_t *)&xs);
-      }
-    }
-
-  return x;
-}
-
-static uint32_t
-fit (x, s)
-     uint32_t           x;
-     enum op_size       s;
-{
-  switch (s)
-    {
-    case WORD:
-      return x;
-    case DAY:
-      return (x & 0b00000000111111111111111111111111);
-    case HALF:
-      return (x & 0b00000000000000001111111111111111);
-    case BYTE:
-      return (x & 0b00000000000000000000000011111111);
-    }
-
-  return x;
-}
-
+/* flags are left pending until read, see flags.h */
 static void
 partial_flagset (vm, r)
      struct yesod_vm    *vm;
      uint8_t            r;
 {
-  if (!vm->regs[r])
-    vm->flags |= FLAG_NIL;
-
-  if ((vm->regs[r] & 0b10000000000000000000000000000000))
-    vm->flags |= FLAG_SIGN;
+  LAZY_RESULT (vm->lazy, vm->regs[r]);
 }
 
-static void
-mov (vm, rd, x)
+/*
+ * the operations of classes I and II, `len` being the bytes loads and
+ * stores access. they return 0 or why the VM stopped
+ */
+static uint32_t
+mov (vm, rd, x, len)
      struct yesod_vm	*vm;
      uint8_t		rd;
      uint32_t		x;
+     uint32_t		len;
 {
   vm->regs[rd] = x;
   partial_flagset (vm, rd);
-}
-
-#define HALF_UINT32_T (0xFFFFFFFF >> 1)
+  (void)len;
 
-static bool
-overflow_add (x, y)
-     uint32_t x, y;
-{
-  int32_t sx = *(int32_t *)&x;
-  int32_t sy = *(int32_t *)&y;
-  int64_t lsx = (int64_t)sx;
-  int64_t lsy = (int64_t)sy;
-
-  int64_t rl = lsx + lsy;
-  int64_t rf = (int64_t)(sx + sy);
-
-  return (rl != rf);
+  return 0;
 }
 
-static void
-add (vm, rd, x)
+static uint32_t
+add (vm, rd, x, len)
      struct yesod_vm	*vm;
      uint8_t		rd;
      uint32_t		x;
+     uint32_t		len;
 {
-  if (overflow_add (vm->regs[rd], x))
-    vm->flags |= FLAG_OVER;
-
-  if (x > HALF_UINT32_T && vm->regs[rd] > HALF_UINT32_T)
-    vm->flags |= FLAG_CARRY;
+  uint32_t a = vm->regs[rd];
 
   vm->regs[rd] += x;
+  LAZY_ADD (vm->lazy, a, x, vm->regs[rd]);
   partial_flagset (vm, rd);
-}
-
-static bool
-overflow_sub (x, y)
-     uint32_t x, y;
-{
-  int32_t sx = *(int32_t *)&x;
-  int32_t sy = *(int32_t *)&y;
-  int64_t lsx = (int64_t)sx;
-  int64_t lsy = (int64_t)sy;
-
-  int64_t rl = lsx - lsy;
-  int64_t rf = (int64_t)(sx - sy);
+  (void)len;
 
-  return (rl != rf);
+  return 0;
 }
 
-static void
-sub (vm, rd, x)
+static uint32_t
+sub (vm, rd, x, len)
      struct yesod_vm	*vm;
      uint8_t		rd;
      uint32_t		x;
+     uint32_t		len;
 {
-  if (overflow_sub (vm->regs[rd], x))
-    vm->flags |= FLAG_OVER;
-
-  if (x < vm->regs[rd])
-    vm->flags |= FLAG_CARRY;
+  uint32_t a = vm->regs[rd];
 
   vm->regs[rd] -= x;
+  LAZY_SUB (vm->lazy, a, x, vm->regs[rd]);
   partial_flagset (vm, rd);
+  (void)len;
+
+  return 0;
 }
 
-static void
-and (vm, rd, x)
+static uint32_t
+and (vm, rd, x, len)
      struct yesod_vm	*vm;
      uint8_t		rd;
      uint32_t		x;
+     uint32_t		len;
 {
   vm->regs[rd] &= x;
   partial_flagset (vm, rd);
+  (void)len;
+
+  return 0;
 }
 
-static void
-or (vm, rd, x)
+static uint32_t
+or (vm, rd, x, len)
      struct yesod_vm	*vm;
      uint8_t		rd;
      uint32_t		x;
+     uint32_t		len;
 {
   vm->regs[rd] |= x;
   partial_flagset (vm, rd);
+  (void)len;
+
+  return 0;
 }
 
-static void
-xor (vm, rd, x)
+static uint32_t
+xor (vm, rd, x, len)
      struct yesod_vm	*vm;
      uint8_t		rd;
      uint32_t		x;
+     uint32_t		len;
 {
   vm->regs[rd] ^= x;
   partial_flagset (vm, rd);
+  (void)len;
+
+  return 0;
 }
 
-static void
-car (vm, rd, x)
+/* loads the `len` bytes at `a` into `rd` */
+static uint32_t
+load (vm, rd, a, len)
      struct yesod_vm	*vm;
      uint8_t		rd;
-     uint32_t		x;
+     uint32_t		a;
+     uint32_t		len;
 {
-  vm->regs[rd] = vm->memory.memory[x];
+  uint32_t x;
+
+  if (!vm->tlb.enabled)
+    x = YESOD_LE (vm->memory.memory + a, len);
+  else if (YESOD_LOAD (vm, a, len, x))
+    return YESOD_FAULT;
+
+  YESOD_CACHE (&vm->dcache, a, len, vm->regs[PC] - 4);
+  vm->counters.reads++;
+
+  vm->regs[rd] = x;
   partial_flagset (vm, rd);
+
+  return 0;
 }
 
-static void
-cdr (vm, rd, x)
+static uint32_t
+car (vm, rd, x, len)
      struct yesod_vm	*vm;
      uint8_t		rd;
      uint32_t		x;
+     uint32_t		len;
 {
-  vm->regs[rd] = vm->memory.memory[x + sizeof(uint32_t)];
-  partial_flagset (vm, rd);
+  if (YESOD_TAG_TRAP (&vm->tags, x))
+    return YESOD_TYPE;
+
+  return load (vm, rd, x, len);
 }
 
-static void
-str (vm, rd, x)
+static uint32_t
+cdr (vm, rd, x, len)
      struct yesod_vm	*vm;
      uint8_t		rd;
      uint32_t		x;
+     uint32_t		len;
 {
-  vm->memory.memory[vm->regs[rd]] = x;
-}
+  uint32_t c = YESOD_CDR (&vm->cons, x);
 
-static void
-cmp (vm, rx, y)
-     struct yesod_vm	*vm;
-     uint8_t		rx;
-     uint32_t		y;
-{
-  vm->regs[0] = vm->regs[rx];
+  if (YESOD_TAG_TRAP (&vm->tags, x))
+    return YESOD_TYPE;
+
+  /* no memory is read for CDR-coded cells, see heap.h */
+  if (YESOD_CDR_CODED (c))
+    {
+      vm->regs[rd] = YESOD_CDR_OF (c, x);
+      partial_flagset (vm, rd);
 
-  return sub(vm, 0, y);
+      return 0;
+    }
+
+  return load (vm, rd, x + (uint32_t)sizeof (uint32_t), len);
 }
 
 static uint32_t
-cycle1 (vm, instr)
-     struct yesod_vm		*vm;
-     struct yesod_instruction1	instr;
+str (vm, rd, x, len)
+     struct yesod_vm	*vm;
+     uint8_t		rd;
+     uint32_t		x;
+     uint32_t		len;
 {
-  uint32_t src = vm->regs[instr.rs];
+  uint32_t a = vm->regs[rd];
 
-  if (!check (vm, instr.cond))
-    return 0;
+  if (!vm->tlb.enabled)
+    YESOD_SET_LE (vm->memory.memory + a, len, x);
+  else if (YESOD_STORE (vm, a, len, x))
+    return YESOD_FAULT;
 
-  uint8_t sh = (instr.shifti ? instr.shift_v.imm : (uint8_t)vm->regs[instr.shift_v.rh]);
+  YESOD_CACHE (&vm->dcache, a, len, vm->regs[PC] - 4);
+  YESOD_COUNT_HEAP (vm, a, a + len);
+  vm->counters.writes++;
 
-  src = shift (src, instr.shift, sh);
+  if (YESOD_CARD (vm, a))
+    YESOD_CARD_MARK (vm, a);
 
-  src = fit (src, instr.size);
+  if (YESOD_PREDECODED (vm, a) || YESOD_PREDECODED (vm, a + len - 1))
+    yesod_predecode_invalidate (vm, a, len);
 
-  switch (instr.opcode)
-    {
-    case NOP:
-      return 0;
-    case HLT:
-      return 1;
-    case MOV:
-      mov (vm, instr.rd, src);
-      return 0;
-    case ADD:
-      add (vm, instr.rd, src);
-      return 0;
-    case SUB:
-      sub (vm, instr.rd, src);
-      return 0;
-    case AND:
-      and (vm, instr.rd, src);
-      return 0;
-    case OR:
-      or (vm, instr.rd, src);
-      return 0;
-    case XOR:
-      xor (vm, instr.rd, src);
-      return 0;
-    case CAR:
-      car (vm, instr.rd, src);
-      return 0;
-    case CDR:
-      cdr (vm, instr.rd, src);
-      return 0;
-    case STR:
-      str (vm, instr.rd, src);
-      return 0;
-    case CMP:
-      cmp (vm, instr.rd, src);
-      return 0;
-    default:
-      return 1;
-    }
+  return 0;
 }
 
 static uint32_t
-cycle2 (vm, instr)
-     struct yesod_vm		*vm;
-     struct yesod_instruction2	instr;
+cmp (vm, rx, y, len)
+     struct yesod_vm	*vm;
+     uint8_t		rx;
+     uint32_t		y;
+     uint32_t		len;
 {
-  uint32_t src = (uint32_t)instr.imm;
-
-  if (!check (vm, instr.cond))
-    return 0;
-
-  if (instr.uplo)
-    src <<= 16;
+  vm->tags.last = vm->regs[rx] ^ y;
+  vm->regs[0] = vm->regs[rx];
 
-  switch (instr.opcode)
-    {
-    case MOV:
-      mov (vm, instr.rd, src);
-      return 0;
-    case ADD:
-      add (vm, instr.rd, src);
-      return 0;
-    case SUB:
-      sub (vm, instr.rd, src);
-      return 0;
-    case AND:
-      and (vm, instr.rd, src);
-      return 0;
-    case OR:
-      or (vm, instr.rd, src);
-      return 0;
-    case XOR:
-      xor (vm, instr.rd, src);
-      return 0;
-    case CAR:
-      car (vm, instr.rd, src);
-      return 0;
-    case CDR:
-      cdr (vm, instr.rd, src);
-      return 0;
-    case STR:
-      str (vm, instr.rd, src);
-      return 0;
-    case CMP:
-      cmp (vm, instr.rd, src);
-      return 0;
-    default:
-      return 1;
-    }
+  return sub (vm, 0, y, len);
 }
 
-static int
+/* returns 0 or why the VM stopped */
+static uint32_t
 push (vm, x)
      struct yesod_vm	*vm;
      uint32_t		x;
@@ -358,105 +253,259 @@ push (vm, x)
   uint32_t sp = vm->regs[SP];
 
   if (sp - STACK > vm->memory.s_size)
-    return 1;
+    return YESOD_STACK_OVERFLOW;
+
+  if (!vm->tlb.enabled)
+    YESOD_SET_LE32 (vm->memory.memory + sp, x);
+  else if (YESOD_STORE (vm, sp, 4, x))
+    return YESOD_FAULT;
 
-  vm->memory.memory[sp] = (uint8_t)x;
-  vm->memory.memory[sp + 1] = (uint8_t)(x >> 8);
-  vm->memory.memory[sp + 2] = (uint8_t)(x >> 16);
-  vm->memory.memory[sp + 3] = (uint8_t)(x >> 24);
+  YESOD_CACHE (&vm->dcache, sp, 4, vm->regs[PC] - 4);
+  vm->counters.pushes++;
+  vm->counters.writes++;
+
+  if (YESOD_PREDECODED (vm, sp) || YESOD_PREDECODED (vm, sp + 3))
+    yesod_predecode_invalidate (vm, sp, 4);
 
   vm->regs[SP] += 4;
 
   return 0;
 }
 
-static uint32_t
-cycle3 (vm, instr)
-     struct yesod_vm		*vm;
-     struct yesod_instruction3	instr;
+static void
+ja (vm, x)
+     struct yesod_vm	*vm;
+     uint32_t		x;
 {
-  uint32_t src = vm->regs[instr.rs];
-
-  if (!check (vm, instr.cond))
-    return 0;
-
-  uint8_t sh = (instr.shifti ? instr.shift_v.imm : (uint8_t)vm->regs[instr.shift_v.rh]);
-
-  src = shift (src, instr.shift, sh);
-
-  src = fit (src, instr.size);
-
-  if (instr.push)
-    if (push (vm, vm->regs[PC]))
-      return 1;
+  vm->regs[PC] = x;
+}
 
-  switch (instr.opcode)
-    {
-    case JA:
-      vm->regs[PC] = src;
-      return 0;
-    case JR:
-      vm->regs[PC] += src - 4 /* we've already incremented pc */;
-      return 0;
-    default:
-      return 1;
-    }
+static void
+jr (vm, x)
+     struct yesod_vm	*vm;
+     uint32_t		x;
+{
+  vm->regs[PC] += x - 4 /* we've already incremented pc */;
 }
 
+/*
+ * specialized handlers, see handler.h
+ *
+ * the shift, size and whether there is a condition are fixed, the
+ * rest is read from the instruction
+ */
+
+typedef uint32_t (*handler) (struct yesod_vm *, const struct yesod_op *);
+
+/* shift count of classes I and III */
+#define COUNT ((op->bits & OP_SHIFTI) ? op->imm : (uint8_t)vm->regs[op->imm])
+
+/* leaves the handler if it has a condition that does not hold */
+#define COND(cc)				\
+  do						\
+    {						\
+      if ((cc) && !check (vm, op->cond))	\
+	return 0;				\
+    }						\
+  while (0)
+
+#define PUSH(p)							\
+  do								\
+    {								\
+      uint32_t ret;						\
+								\
+      if ((p) && (ret = push (vm, vm->regs[PC])))		\
+	return ret;						\
+    }								\
+  while (0)
+
+#define CLASS1(o, name, sh, sz, cc)					\
+  static uint32_t							\
+  c1_##name##_##sh##_##sz##_##cc (vm, op)				\
+       struct yesod_vm		*vm;					\
+       const struct yesod_op	*op;					\
+  {									\
+    uint32_t src = vm->regs[op->rb];					\
+									\
+    COND (cc);								\
+    return name (vm, op->ra, YESOD_FIT_##sz (YESOD_SHIFT_##sh (src, COUNT)), \
+		 YESOD_LEN_##sz);					\
+  }
+
+#define CLASS2(o, name, u, cc)						\
+  static uint32_t							\
+  c2_##name##_##u##_##cc (vm, op)					\
+       struct yesod_vm		*vm;					\
+       const struct yesod_op	*op;					\
+  {									\
+    COND (cc);								\
+    return name (vm, op->ra, (uint32_t)op->imm << 16 * (u), YESOD_LEN_WORD); \
+  }
+
+#define CLASS3(o, name, sh, sz, cc)					\
+  static uint32_t							\
+  c3_##name##_##sh##_##sz##_##cc (vm, op)				\
+       struct yesod_vm		*vm;					\
+       const struct yesod_op	*op;					\
+  {									\
+    uint32_t src = vm->regs[op->ra];					\
+									\
+    COND (cc);								\
+    src = YESOD_FIT_##sz (YESOD_SHIFT_##sh (src, COUNT));		\
+    PUSH (op->bits & OP_PUSH);						\
+    name (vm, src);							\
+									\
+    return 0;								\
+  }
+
+#define CLASS4(o, name, p, cc)						\
+  static uint32_t							\
+  c4_##name##_##p##_##cc (vm, op)					\
+       struct yesod_vm		*vm;					\
+       const struct yesod_op	*op;					\
+  {									\
+    uint32_t src;							\
+									\
+    COND (cc);								\
+    src = op->imm | (vm->regs[op->ra] << 16);				\
+    PUSH (p);								\
+    name (vm, src);							\
+									\
+    return 0;								\
+  }
+
+/* halts and invalid opcodes only stop if their condition holds */
+#define FIXED(cc)							\
+  static uint32_t							\
+  c1_hlt_##cc (vm, op)							\
+       struct yesod_vm		*vm;					\
+       const struct yesod_op	*op;					\
+  {									\
+    COND (cc);								\
+									\
+    return YESOD_HALT;							\
+  }									\
+									\
+  static uint32_t							\
+  invalid_##cc (vm, op)							\
+       struct yesod_vm		*vm;					\
+       const struct yesod_op	*op;					\
+  {									\
+    COND (cc);								\
+									\
+    return YESOD_INVALID;						\
+  }									\
+									\
+  static uint32_t							\
+  jump_invalid_##cc (vm, op)						\
+       struct yesod_vm		*vm;					\
+       const struct yesod_op	*op;					\
+  {									\
+    COND (cc);								\
+    PUSH (op->bits & OP_PUSH);						\
+									\
+    return YESOD_INVALID;						\
+  }
+
+#define HANDLERS(cc)				\
+  YESOD_CLASS1_HANDLERS (CLASS1, cc)		\
+  YESOD_CLASS2_HANDLERS (CLASS2, cc)		\
+  YESOD_CLASS3_HANDLERS (CLASS3, cc)		\
+  YESOD_CLASS4_HANDLERS (CLASS4, cc)		\
+  FIXED (cc)
+
+HANDLERS (0)
+HANDLERS (1)
+
 static uint32_t
-cycle4 (vm, instr)
+c1_nop (vm, op)
      struct yesod_vm		*vm;
-     struct yesod_instruction4	instr;
+     const struct yesod_op	*op;
 {
-  uint32_t src = instr.imm;
+  (void)vm;
+  (void)op;
 
-  if (!check (vm, instr.cond))
-    return 0;
+  return 0;
+}
 
-  src |= (vm->regs[instr.rp] << 16);
-  
-  if (instr.push)
-    if (push (vm, vm->regs[PC]))
-      return 1;
+#define ADDRESS(h) h
 
-  switch (instr.opcode)
-    {
-    case JA:
-      vm->regs[PC] = src;
-      return 0;
-    case JR:
-      vm->regs[PC] += src - 4 /* we've already incremented pc */;
-      return 0;
-    default:
-      return 1;
-    }
-}
+static const handler handlers[YESOD_HANDLERS] = {
+  YESOD_HANDLER_TABLE (ADDRESS, 0)
+  YESOD_HANDLER_TABLE (ADDRESS, 1)
+};
 
 uint32_t
 yesod_cycle (vm)
      struct yesod_vm *vm;
 {
-  uint32_t			raw;
-  struct yesod_instruction	instr;
+  uint32_t		pc = vm->regs[PC], word = 0, ret;
+  const struct yesod_op	*op;
+  struct yesod_op	uncached;
+  uint64_t		imisses, dmisses;
+  bool			executed, retired;
+
+  if (YESOD_PREDECODED (vm, pc) && !((pc - vm->decoded.base) & 3))
+    {
+      op = &vm->decoded.ops[(pc - vm->decoded.base) >> 2];
+
+      if (!(op->bits & OP_VALID))
+	op = yesod_predecode_fill (vm, pc);
+
+      /* the word decoded, which the instruction may overwrite */
+      if (vm->trace.path)
+	word = YESOD_LE32 (vm->memory.memory + pc);
+    }
+  else
+    {
+      if (YESOD_SERVICE (vm, pc))
+	return yesod_service (vm, pc);
 
-  raw = fetch (vm);
-  instr = yesod_decode (raw);
+      if (vm->tlb.enabled && yesod_tlb_fetch (vm, pc))
+	return YESOD_FAULT;
+
+      word = yesod_fetch (vm, pc);
+      uncached = yesod_predecode (word);
+      op = &uncached;
+    }
+
+  imisses = vm->icache.misses;
+  YESOD_CACHE (&vm->icache, pc, 4, pc);
 
   /* reset x0 to 0 before every cycle */
   vm->regs[0] = 0;
   vm->regs[PC] += 4;
 
-  switch (instr.class)
+  /* timing, profiling and tracing, see pipe.h, prof.h and trace.h */
+  executed = (vm->pipe.enabled || vm->prof.enabled || vm->trace.path)
+    && check (vm, op->cond);
+  dmisses = vm->dcache.misses;
+  ret = handlers[op->handler] (vm, op);
+
+  /* counted after every jump, see counters.h */
+  if (op->class == INSTR_CLASS3 || op->class == INSTR_CLASS4)
     {
-    case INSTR_CLASS1:
-      return cycle1 (vm, instr.instr.instr1);
-    case INSTR_CLASS2:
-      return cycle2 (vm, instr.instr.instr2);
-    case INSTR_CLASS3:
-      return cycle3 (vm, instr.instr.instr3);
-    case INSTR_CLASS4:
-      return cycle4 (vm, instr.instr.instr4);
+      if (vm->regs[PC] != pc + 4)
+	vm->counters.taken++;
+      else
+	vm->counters.not_taken++;
+
+      YESOD_COUNT_SP (vm, vm->regs[SP]);
     }
 
-  return 0;
+  /* HLT retires, an instruction that traps does not, see counters.h */
+  retired = !ret || ret == YESOD_HALT;
+
+  if (vm->pipe.enabled && retired)
+    yesod_pipe_retire (vm, op, executed, vm->regs[PC] != pc + 4,
+		       vm->icache.misses - imisses,
+		       vm->dcache.misses - dmisses);
+
+  if (vm->prof.enabled && retired)
+    yesod_prof_retire (vm, op, pc, executed);
+
+  if (vm->trace.path)
+    yesod_trace_retire (vm, op, pc, word, executed);
+
+  return ret;
 }
@@ -3,6 +3,18 @@
 
 # include "vm.h"
 
+/* why the VM stopped, as returned by `yesod_cycle` and `yesod_run` */
+enum yesod_stop_reason {
+  YESOD_RUNNING = 0,		/* not stopped */
+  YESOD_HALT,			/* HLT */
+  YESOD_BUDGET,			/* instruction budget exhausted */
+  YESOD_INVALID,		/* invalid opcode for its class */
+  YESOD_STACK_OVERFLOW,		/* push past the end of the stack */
+  YESOD_FAULT,			/* guest memory fault, see fault.h */
+  YESOD_TYPE			/* CAR or CDR of a word not tagged cons, see tags.h */
+};
+
+/* executes a single instruction, returns 0 or the reason it stopped */
 uint32_t yesod_cycle (struct yesod_vm *);
 
 #endif /* YESOD_CYCLE_ */
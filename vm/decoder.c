@@ -1,4 +1,5 @@
 #include "decoder.h"
+#include "handler.h"
 
 #define OPCODE(x) ((x &         0b11111100) >> 2)
 #define REG1(x)   ((x &     0b111100000000) >> 8)
@@ -128,3 +129,105 @@ yesod_decode (raw)
 
   return instr;
 }
+
+/* index of the specialized handler of `op`, see handler.h */
+static uint16_t
+handler (op)
+     const struct yesod_op *op;
+{
+  bool		cc = op->cond != ALW;
+  uint8_t	opcode = op->opcode > CMP ? YESOD_OPCODE_INVALID : op->opcode;
+
+  switch (op->class)
+    {
+    case INSTR_CLASS2:
+      return YESOD_HANDLER (cc, op->class, opcode, 0, !!(op->bits & OP_UPLO));
+    case INSTR_CLASS4:
+      return YESOD_HANDLER (cc, op->class, opcode, 0, !!(op->bits & OP_PUSH));
+    }
+
+  return YESOD_HANDLER (cc, op->class, opcode, op->shift, op->size);
+}
+
+struct yesod_op
+yesod_predecode (raw)
+     uint32_t raw;
+{
+  struct yesod_instruction	instr = yesod_decode (raw);
+  struct yesod_op		op;
+
+  op.class = instr.class;
+  op.ra = op.rb = 0;
+  op.shift = NONE;
+  op.size = WORD;
+  op.bits = OP_VALID;
+  op.imm = 0;
+
+  switch (instr.class)
+    {
+    case INSTR_CLASS1:
+      op.opcode = instr.instr.instr1.opcode;
+      op.ra = instr.instr.instr1.rd;
+      op.rb = instr.instr.instr1.rs;
+      op.shift = instr.instr.instr1.shift;
+      op.size = instr.instr.instr1.size;
+      op.cond = instr.instr.instr1.cond;
+      if (instr.instr.instr1.shifti)
+	{
+	  op.bits |= OP_SHIFTI;
+	  op.imm = instr.instr.instr1.shift_v.imm;
+	}
+      else
+	op.imm = instr.instr.instr1.shift_v.rh;
+      break;
+    case INSTR_CLASS2:
+      op.opcode = instr.instr.instr2.opcode;
+      op.ra = instr.instr.instr2.rd;
+      op.cond = instr.instr.instr2.cond;
+      if (instr.instr.instr2.uplo)
+	op.bits |= OP_UPLO;
+      op.imm = instr.instr.instr2.imm;
+      break;
+    case INSTR_CLASS3:
+      op.opcode = instr.instr.instr3.opcode;
+      op.ra = instr.instr.instr3.rs;
+      op.shift = instr.instr.instr3.shift;
+      op.size = instr.instr.instr3.size;
+      op.cond = instr.instr.instr3.cond;
+      if (instr.instr.instr3.push)
+	op.bits |= OP_PUSH;
+      if (instr.instr.instr3.shifti)
+	{
+	  op.bits |= OP_SHIFTI;
+	  op.imm = instr.instr.instr3.shift_v.imm;
+	}
+      else
+	op.imm = instr.instr.instr3.shift_v.rh;
+      break;
+    case INSTR_CLASS4:
+      op.opcode = instr.instr.instr4.opcode;
+      op.ra = instr.instr.instr4.rp;
+      op.cond = instr.instr.instr4.cond;
+      if (instr.instr.instr4.push)
+	op.bits |= OP_PUSH;
+      op.imm = instr.instr.instr4.imm;
+      break;
+    }
+
+  op.handler = handler (&op);
+
+  return op;
+}
+
+static const char *const opcodes[16] = {
+  "nop", "mov", "add", "sub", "and", "or", "xor", "car",
+  "cdr", "str", "ja", "jr", "hlt", "cmp", "0xe", "0xf"
+};
+
+/* mnemonic of `opcode`, or its number if it has none */
+const char *
+yesod_opcode_name (opcode)
+     uint8_t opcode;
+{
+  return opcodes[opcode & 15];
+}
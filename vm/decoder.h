@@ -40,6 +40,7 @@ enum op_size {
  * 010 - less than, unsigned
  * 011 - greater or equal, unsigned
  * 100 - equal
+ * 101 - same tag, see tags.h
  * 110 - less than, signed
  * 111 - greater or equal, signed
  */
@@ -49,6 +50,7 @@ enum cond {
   LTU = 0b010,
   GEU = 0b011,
   EEQ = 0b100,
+  TAG = 0b101,
   LTS = 0b110,
   GES = 0b111,
 };
@@ -169,6 +171,35 @@ struct yesod_instruction {
   }				instr;
 };
 
+/*
+ * compact form of a decoded instruction, as kept by the predecoded
+ * instruction cache
+ *
+ * `ra` holds rd (I, II), rs (III) or rp (IV), `rb` holds rs (I) and
+ * `imm` holds either the immediate (II, IV) or the shift register or
+ * immediate (I, III). `handler` is the specialized handler of the
+ * instruction, see handler.h
+ */
+struct yesod_op {
+  uint8_t	class;
+  uint8_t	opcode;
+  uint8_t	ra;
+  uint8_t	rb;
+  uint8_t	shift;
+  uint8_t	size;
+  uint8_t	cond;
+  uint8_t	bits;
+  uint16_t	imm;
+  uint16_t	handler;
+};
+
+# define OP_SHIFTI (0b00000001)
+# define OP_PUSH   (0b00000010)
+# define OP_UPLO   (0b00000100)
+# define OP_VALID  (0b10000000)
+
 struct yesod_instruction yesod_decode (uint32_t); 
+struct yesod_op yesod_predecode (uint32_t);
+const char *yesod_opcode_name (uint8_t);
 
 #endif /* YESOD_DECODER_ */
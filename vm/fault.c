@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stddef.h>
+#include <ucontext.h>
+#include "fault.h"
+#include "vm.h"
+
+/*
+ * the VM whose engine the thread is running, NULL outside of
+ * `yesod_run`. the handler is installed once for the whole process,
+ * `previous` being the one it replaced, which gets every SIGSEGV that
+ * is not a fault of the guest
+ */
+static __thread struct yesod_vm *volatile armed;
+static __thread sigjmp_buf *env;
+static struct sigaction previous;
+static pthread_once_t installed = PTHREAD_ONCE_INIT;
+
+static void
+on_fault (sig, info, context)
+     int	sig;
+     siginfo_t	*info;
+     void	*context;
+{
+  struct yesod_vm	*vm = armed;
+  uintptr_t		a = (uintptr_t)info->si_addr, base;
+
+  if (vm)
+    {
+      base = (uintptr_t)vm->memory.memory;
+
+      if (a >= base && a - base < vm->memory.reserved)
+	{
+	  vm->fault.host = a;
+#if defined (__x86_64__) && defined (REG_RIP)
+	  vm->fault.ip = ((ucontext_t *)context)->uc_mcontext.gregs[REG_RIP];
+#else
+	  vm->fault.ip = 0;
+	  (void)context;
+#endif
+	  siglongjmp (*env, 1);
+	}
+    }
+
+  /* not a guest access, the signal is the previous handler's */
+  if (previous.sa_flags & SA_SIGINFO)
+    previous.sa_sigaction (sig, info, context);
+  else if (previous.sa_handler == SIG_IGN && info->si_code <= 0)
+    return;
+  else if (previous.sa_handler == SIG_DFL || previous.sa_handler == SIG_IGN)
+    {
+      /* which kills the process, as a fault cannot be ignored */
+      signal (sig, SIG_DFL);
+      raise (sig);
+    }
+  else
+    previous.sa_handler (sig);
+}
+
+static void
+install ()
+{
+  struct sigaction sa;
+
+  sa.sa_sigaction = on_fault;
+  sa.sa_flags = SA_SIGINFO;
+  sigemptyset (&sa.sa_mask);
+
+  sigaction (SIGSEGV, &sa, &previous);
+}
+
+/*
+ * catches the faults of `vm`, in the calling thread, until
+ * `yesod_fault_disarm`, jumping to the sigjmp_buf `to`
+ */
+void
+yesod_fault_arm (vm, to)
+     struct yesod_vm	*vm;
+     void		*to;
+{
+  pthread_once (&installed, install);
+
+  vm->fault.fetching = 0;
+  env = to;
+  armed = vm;
+}
+
+void
+yesod_fault_disarm ()
+{
+  armed = NULL;
+}
+
+/*
+ * works out the instruction at fault and its access from the host
+ * fault, and how many instructions ran before it. the interpreters
+ * set x14 to the next pc before running an instruction, and native
+ * code is looked up by host address
+ */
+void
+yesod_fault_resolve (vm)
+     struct yesod_vm *vm;
+{
+  struct yesod_fault	*f = &vm->fault;
+  struct yesod_op	op;
+
+  f->addr = (uint32_t)(f->host - (uintptr_t)vm->memory.memory);
+
+  if (f->fetching)
+    {
+      f->access = YESOD_FETCH;
+      f->fetching = 0;
+      f->executed += (f->pc - f->from) / 4;
+      return;
+    }
+
+  if (!yesod_jit_pc (vm, f->ip, &f->pc))
+    f->pc = vm->regs[PC] - 4;
+
+  f->executed += (f->pc - f->from) / 4;
+
+  op = yesod_predecode (yesod_fetch (vm, f->pc));
+
+  /* stores, and jumps, which can only fault pushing */
+  f->access = op.opcode == STR || op.class == INSTR_CLASS3
+    || op.class == INSTR_CLASS4 ? YESOD_WRITE : YESOD_READ;
+}
+
+/* the word at `pc`, read as an instruction fetch */
+uint32_t
+yesod_fetch (vm, pc)
+     struct yesod_vm	*vm;
+     uint32_t		pc;
+{
+  uint8_t	*m = vm->memory.memory;
+  uint32_t	x;
+
+  vm->fault.pc = pc;
+  vm->fault.fetching = 1;
+
+  x = (uint32_t)m[pc]
+    | ((uint32_t)m[(uint32_t)(pc + 1)] << 8)
+    | ((uint32_t)m[(uint32_t)(pc + 2)] << 16)
+    | ((uint32_t)m[(uint32_t)(pc + 3)] << 24);
+
+  vm->fault.fetching = 0;
+
+  return x;
+}
+
+const char *
+yesod_access_name (access)
+     enum yesod_access access;
+{
+  switch (access)
+    {
+    case YESOD_READ:
+      return "read";
+    case YESOD_WRITE:
+      return "write";
+    case YESOD_FETCH:
+      return "fetch";
+    }
+
+  return "unknown";
+}
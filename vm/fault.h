@@ -0,0 +1,49 @@
+#ifndef YESOD_FAULT_
+# define YESOD_FAULT_
+
+# include <stdint.h>
+
+struct yesod_vm;
+
+enum yesod_access {
+  YESOD_READ,
+  YESOD_WRITE,
+  YESOD_FETCH
+};
+
+/*
+ * guest memory fault, in protected mode (see mem.h)
+ *
+ * accesses are not checked. the host faults on the guard pages, and
+ * the SIGSEGV handler jumps out of the engine to the sigjmp_buf
+ * `yesod_run` armed it with, and the instruction at fault is worked
+ * out from there. fetches outside of .text go through
+ * `yesod_fetch`, which marks them as such. registers, flags and memory
+ * are those of right before the faulting instruction, as engines that
+ * keep flags in locals write them back before every access that may
+ * fault. they also keep `from`, the start of the straight run of
+ * instructions they are in, and `executed`, the instructions run
+ * before it, so that the ones run before the fault are known
+ *
+ * faults are caught by each thread, so that several can run a VM
+ */
+struct yesod_fault {
+  uint32_t		pc;
+  uint32_t		addr;
+  enum yesod_access	access;
+
+  volatile uint32_t	from;
+  volatile uint64_t	executed;	/* up to the fault, once resolved */
+
+  volatile int		fetching;
+  volatile uintptr_t	host;	/* faulting host address */
+  volatile uintptr_t	ip;	/* host instruction at fault */
+};
+
+void		yesod_fault_arm (struct yesod_vm *, void *);
+void		yesod_fault_disarm (void);
+void		yesod_fault_resolve (struct yesod_vm *);
+uint32_t	yesod_fetch (struct yesod_vm *, uint32_t);
+const char	*yesod_access_name (enum yesod_access);
+
+#endif /* YESOD_FAULT_ */
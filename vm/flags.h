@@ -0,0 +1,52 @@
+#ifndef YESOD_FLAGS_
+# define YESOD_FLAGS_
+
+# include <stdint.h>
+
+# define FLAG_NIL   (0b00000001)
+# define FLAG_CARRY (0b00000010)
+# define FLAG_SIGN  (0b00000100)
+# define FLAG_OVER  (0b00001000)
+
+/*
+ * lazily evaluated flags
+ *
+ * flags are only ever set, so rather than testing every result the
+ * ALU ors what each flag is computed from into a word of its own.
+ * the flags themselves are worked out of these words when a
+ * condition or `yesod_flags` reads them
+ *
+ * nil is nonzero once a result was 0. carry, sign and over are set
+ * when their bit 31 is
+ */
+struct yesod_lazy {
+  uint32_t	nil;
+  uint32_t	carry;
+  uint32_t	sign;
+  uint32_t	over;
+};
+
+# define SIGN_BIT (0x80000000)
+
+/* NIL and SIGN of result `x` */
+# define LAZY_RESULT(l, x)			\
+  ((l).nil |= !(x), (l).sign |= (x))
+
+/* CARRY and OVER of `a + b`, `x` being the sum */
+# define LAZY_ADD(l, a, b, x)					\
+  ((l).carry |= (a) & (b), (l).over |= ((a) ^ (x)) & ((b) ^ (x)))
+
+/* CARRY and OVER of `a - b`, `x` being the difference */
+# define LAZY_SUB(l, a, b, x)					\
+  ((l).carry |= (uint32_t)((b) < (a)) << 31,			\
+   (l).over |= ((a) ^ (b)) & ((a) ^ (x)))
+
+/* `flags` along with the flags pending in `l` */
+# define LAZY_FOLD(flags, l)				\
+  ((uint8_t)((flags)					\
+	     | ((l).nil ? FLAG_NIL : 0)			\
+	     | (((l).carry >> 31) << 1)			\
+	     | (((l).sign >> 31) << 2)			\
+	     | (((l).over >> 31) << 3)))
+
+#endif /* YESOD_FLAGS_ */
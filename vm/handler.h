@@ -0,0 +1,161 @@
+#ifndef YESOD_HANDLER_
+# define YESOD_HANDLER_
+
+# include <stdint.h>
+# include "decoder.h"
+
+/*
+ * specialized instruction handlers
+ *
+ * every decoded instruction maps to a handler with its shift kind,
+ * size mask and whether it has a condition fixed at compile time (see
+ * `yesod_op.handler`). the engines generate their handlers from the
+ * lists below
+ *
+ * | 10 |  8..9 |  4..7  | 2..3  | 0..1 |
+ * | cc | class | opcode | shift | size |
+ *
+ * cc is set unless the condition always holds. invalid opcodes share
+ * slot 15. classes II and IV have neither shift nor size, and keep
+ * upper/lower (II) or push (IV) in place of the size
+ */
+# define YESOD_HANDLER(cc, cl, opc, sh, sz)				\
+  (((cc) << 10) | ((cl) << 8) | ((opc) << 4) | ((sh) << 2) | (sz))
+
+# define YESOD_HANDLERS       (1 << 11)
+# define YESOD_OPCODE_INVALID (15)
+
+/* true if handler `h` tests a condition */
+# define YESOD_HANDLER_CC(h) (((h) >> 10) & 1)
+
+/*
+ * fused pairs of instructions, which blocks run through the handler of
+ * their first instruction (see block.c), indexed past the others
+ *
+ * CONST    - class II MOV of an upper half and OR of the lower half
+ *            into the same register
+ * CMP      - unconditional CMP of class I without shift or size, or of
+ *            class II with a lower immediate, and a JA or JR without
+ *            push, of class III without shift or size, or of class IV
+ */
+# define YESOD_FUSED_CONST (YESOD_HANDLERS)
+# define YESOD_FUSED_CMP(cmp, cl, opc)					\
+  (YESOD_HANDLERS + 1 + (((cmp) << 2) | (((cl) & 1) << 1) | ((opc) == JR)))
+
+# define YESOD_FUSED (9)
+
+/* X (opcode, name, ...) for the ALU opcodes of classes I and II */
+# define YESOD_ALU_OPS(X, ...)						\
+  X (MOV, mov, __VA_ARGS__) X (ADD, add, __VA_ARGS__)			\
+  X (SUB, sub, __VA_ARGS__) X (AND, and, __VA_ARGS__)			\
+  X (OR, or, __VA_ARGS__)   X (XOR, xor, __VA_ARGS__)			\
+  X (CAR, car, __VA_ARGS__) X (CDR, cdr, __VA_ARGS__)			\
+  X (STR, str, __VA_ARGS__) X (CMP, cmp, __VA_ARGS__)
+
+/* X (opcode, name, ...) for the opcodes of classes III and IV */
+# define YESOD_JUMP_OPS(X, ...)						\
+  X (JA, ja, __VA_ARGS__) X (JR, jr, __VA_ARGS__)
+
+# define YESOD_SHIFTS(X, ...)						\
+  X (NONE, __VA_ARGS__) X (LSL, __VA_ARGS__)				\
+  X (LSR, __VA_ARGS__)  X (ASR, __VA_ARGS__)
+
+# define YESOD_SIZES(X, ...)						\
+  X (WORD, __VA_ARGS__) X (DAY, __VA_ARGS__)				\
+  X (HALF, __VA_ARGS__) X (BYTE, __VA_ARGS__)
+
+/* `x` shifted by `s`, which is only evaluated when there is a shift */
+# define YESOD_SHIFT_NONE(x, s) (x)
+# define YESOD_SHIFT_LSL(x, s)  ((x) << (uint32_t)(s))
+# define YESOD_SHIFT_LSR(x, s)  ((x) >> (uint32_t)(s))
+# define YESOD_SHIFT_ASR(x, s)  ((uint32_t)((int32_t)(x) >> (s)))
+
+# define YESOD_FIT_WORD(x) (x)
+# define YESOD_FIT_DAY(x)  ((x) & 0x00FFFFFF)
+# define YESOD_FIT_HALF(x) ((x) & 0x0000FFFF)
+# define YESOD_FIT_BYTE(x) ((x) & 0x000000FF)
+
+/* bytes loaded or stored, little-endian, see tlb.h */
+# define YESOD_LEN_WORD (4)
+# define YESOD_LEN_DAY  (3)
+# define YESOD_LEN_HALF (2)
+# define YESOD_LEN_BYTE (1)
+
+/*
+ * H for every handler of a class, followed by the remaining arguments:
+ *
+ * I, III - H (opcode, name, shift, size, ...)
+ * II     - H (opcode, name, upper/lower, ...)
+ * IV     - H (opcode, name, push, ...)
+ *
+ * upper/lower and push are 0 or 1
+ */
+# define YESOD_CLASS1_HANDLERS(H, ...)				\
+  YESOD_ALU_OPS (YESOD_EACH_SHIFT_, H, __VA_ARGS__)
+# define YESOD_CLASS2_HANDLERS(H, ...)				\
+  YESOD_ALU_OPS (YESOD_EACH_BIT_, H, __VA_ARGS__)
+# define YESOD_CLASS3_HANDLERS(H, ...)				\
+  YESOD_JUMP_OPS (YESOD_EACH_SHIFT_, H, __VA_ARGS__)
+# define YESOD_CLASS4_HANDLERS(H, ...)				\
+  YESOD_JUMP_OPS (YESOD_EACH_BIT_, H, __VA_ARGS__)
+
+# define YESOD_EACH_SHIFT_(o, name, H, ...)			\
+  YESOD_SHIFTS (YESOD_EACH_SIZE_, o, name, H, __VA_ARGS__)
+# define YESOD_EACH_SIZE_(sh, o, name, H, ...)			\
+  YESOD_SIZES (YESOD_EACH_, sh, o, name, H, __VA_ARGS__)
+# define YESOD_EACH_(sz, sh, o, name, H, ...)			\
+  H (o, name, sh, sz, __VA_ARGS__)
+# define YESOD_EACH_BIT_(o, name, H, ...)			\
+  H (o, name, 0, __VA_ARGS__) H (o, name, 1, __VA_ARGS__)
+
+/*
+ * initializers for the handlers with condition `cc` in a table of
+ * YESOD_HANDLERS entries, `A (handler)` being the address of a handler
+ *
+ * the handlers are named after their class, opcode, shift and size, or
+ * upper/lower or push, and condition:
+ *
+ * c1_<name>_<shift>_<size>_<cc>	c2_<name>_<upper/lower>_<cc>
+ * c3_<name>_<shift>_<size>_<cc>	c4_<name>_<push>_<cc>
+ *
+ * along with c1_nop, c1_hlt_<cc>, and invalid_<cc> and
+ * jump_invalid_<cc> for the invalid opcodes of classes I and II, and
+ * III and IV. the entries that no instruction maps to are left empty
+ */
+# define YESOD_HANDLER_TABLE(A, cc)					\
+  YESOD_RANGE_ (cc, INSTR_CLASS1, NOP, NOP) = A (c1_nop),		\
+  YESOD_CLASS1_HANDLERS (YESOD_ENTRY1_, A, cc)				\
+  YESOD_RANGE_ (cc, INSTR_CLASS1, JA, JR) = A (invalid_##cc),		\
+  YESOD_RANGE_ (cc, INSTR_CLASS1, HLT, HLT) = A (c1_hlt_##cc),		\
+  YESOD_RANGE_ (cc, INSTR_CLASS1, CMP + 1, YESOD_OPCODE_INVALID)	\
+    = A (invalid_##cc),							\
+									\
+  YESOD_RANGE_ (cc, INSTR_CLASS2, NOP, NOP) = A (invalid_##cc),		\
+  YESOD_CLASS2_HANDLERS (YESOD_ENTRY2_, A, cc)				\
+  YESOD_RANGE_ (cc, INSTR_CLASS2, JA, HLT) = A (invalid_##cc),		\
+  YESOD_RANGE_ (cc, INSTR_CLASS2, CMP + 1, YESOD_OPCODE_INVALID)	\
+    = A (invalid_##cc),							\
+									\
+  YESOD_RANGE_ (cc, INSTR_CLASS3, NOP, STR) = A (jump_invalid_##cc),	\
+  YESOD_CLASS3_HANDLERS (YESOD_ENTRY3_, A, cc)				\
+  YESOD_RANGE_ (cc, INSTR_CLASS3, HLT, YESOD_OPCODE_INVALID)		\
+    = A (jump_invalid_##cc),						\
+									\
+  YESOD_RANGE_ (cc, INSTR_CLASS4, NOP, STR) = A (jump_invalid_##cc),	\
+  YESOD_CLASS4_HANDLERS (YESOD_ENTRY4_, A, cc)				\
+  YESOD_RANGE_ (cc, INSTR_CLASS4, HLT, YESOD_OPCODE_INVALID)		\
+    = A (jump_invalid_##cc),
+
+# define YESOD_RANGE_(cc, cl, from, to)					\
+  [YESOD_HANDLER (cc, cl, from, 0, 0) ... YESOD_HANDLER (cc, cl, to, 3, 3)]
+
+# define YESOD_ENTRY1_(o, name, sh, sz, A, cc)				\
+  [YESOD_HANDLER (cc, INSTR_CLASS1, o, sh, sz)] = A (c1_##name##_##sh##_##sz##_##cc),
+# define YESOD_ENTRY2_(o, name, u, A, cc)				\
+  [YESOD_HANDLER (cc, INSTR_CLASS2, o, 0, u)] = A (c2_##name##_##u##_##cc),
+# define YESOD_ENTRY3_(o, name, sh, sz, A, cc)				\
+  [YESOD_HANDLER (cc, INSTR_CLASS3, o, sh, sz)] = A (c3_##name##_##sh##_##sz##_##cc),
+# define YESOD_ENTRY4_(o, name, p, A, cc)				\
+  [YESOD_HANDLER (cc, INSTR_CLASS4, o, 0, p)] = A (c4_##name##_##p##_##cc),
+
+#endif /* YESOD_HANDLER_ */
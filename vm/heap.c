@@ -0,0 +1,556 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "heap.h"
+#include "vm.h"
+
+static uint64_t
+now ()
+{
+  struct timespec t;
+
+  clock_gettime (CLOCK_MONOTONIC, &t);
+
+  return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* page of the heap address `a`, and address of page `p` */
+#define PAGE(h, a) (((a) - (h)->base) / YESOD_HEAP_PAGE)
+#define PAGE_AT(h, p) ((h)->base + (p) * YESOD_HEAP_PAGE)
+
+/* space of free pages */
+#define FREE (0)
+
+int
+yesod_heap_init (vm)
+     struct yesod_vm *vm;
+{
+  struct yesod_heap	*h = &vm->cons;
+  uint32_t		size = vm->rodata > vm->heap ? vm->rodata - vm->heap : 0;
+  bool			coded = h->coded;
+
+  memset (h, 0, sizeof (*h));
+
+  h->coded = coded;
+  h->base = vm->heap;
+  h->pages = size / YESOD_HEAP_PAGE;
+  h->size = h->pages * YESOD_HEAP_PAGE;
+  h->current = 1;
+
+  h->space = calloc (h->pages + 1, sizeof (*h->space));
+  h->used = calloc (h->pages + 1, sizeof (*h->used));
+  h->queue = calloc (h->pages + 1, sizeof (*h->queue));
+
+  /* the bitmap is only touched by collections */
+  h->forwarded = calloc (h->size / 4 / 8 + 1, 1);
+
+  if (coded)
+    h->codes = calloc (h->size / 4 / 4 + 1, 1);
+
+  return !h->space || !h->used || !h->queue || !h->forwarded
+    || (coded && !h->codes);
+}
+
+static void
+set_code (h, a, code)
+     struct yesod_heap	*h;
+     uint32_t		a;
+     uint8_t		code;
+{
+  uint8_t *c = &h->codes[(a - h->base) >> 4];
+  uint8_t shift = ((a - h->base) >> 1) & 6;
+
+  *c = (*c & ~(3 << shift)) | code << shift;
+}
+
+static bool
+forwarded (h, w)
+     struct yesod_heap	*h;
+     uint32_t		w;
+{
+  uint32_t i = (w - h->base) / 4;
+
+  return h->forwarded[i / 8] & (1 << i % 8);
+}
+
+/* true if the word at `a`, in the heap, was allocated */
+static bool
+live (h, a)
+     struct yesod_heap	*h;
+     uint32_t		a;
+{
+  uint32_t p = PAGE (h, a);
+
+  return h->space[p] != FREE && a - PAGE_AT (h, p) < h->used[p];
+}
+
+/* true if `w` is the address of a cell */
+static bool
+cell_at (h, w)
+     struct yesod_heap	*h;
+     uint32_t		w;
+{
+  uint32_t off = w - h->base;
+
+  if (off >= h->size || off % (h->coded ? 4 : YESOD_CELL) || !live (h, w))
+    return false;
+
+  return !h->coded || YESOD_CDR_CODE (h, w) != YESOD_CDR_TAIL;
+}
+
+/*
+ * gives `n` free pages in a row to `space`, the first one in `at`, or
+ * returns 1 if there are none. pages given to a space other than the
+ * current one are queued for the collection
+ */
+static int
+claim (h, space, n, at)
+     struct yesod_heap	*h;
+     uint8_t		space;
+     uint32_t		n;
+     uint32_t		*at;
+{
+  uint32_t p, q, run, pass;
+
+  for (pass = 0; pass < 2; pass++)
+    for (p = pass ? 0 : h->rover, run = 0; p < h->pages; p++)
+      {
+	run = h->space[p] == FREE ? run + 1 : 0;
+
+	if (run < n)
+	  continue;
+
+	for (q = p + 1 - n; q <= p; q++)
+	  {
+	    h->space[q] = space;
+	    h->used[q] = 0;
+
+	    if (space == h->current)
+	      h->claimed++;
+	    else
+	      h->queue[h->queued++] = q;
+	  }
+
+	*at = p + 1 - n;
+	h->rover = p + 1;
+
+	return 0;
+      }
+
+  return 1;
+}
+
+/* takes `size` bytes off the pages last claimed, which must hold them */
+static uint32_t
+bump (h, size)
+     struct yesod_heap	*h;
+     uint32_t		size;
+{
+  uint32_t x = h->next, p;
+
+  h->next += size;
+
+  for (p = PAGE (h, x); p <= PAGE (h, h->next - 1); p++)
+    h->used[p] = h->next - PAGE_AT (h, p) < YESOD_HEAP_PAGE
+      ? h->next - PAGE_AT (h, p) : YESOD_HEAP_PAGE;
+
+  return x;
+}
+
+/*
+ * makes room for `size` bytes in `space`, claiming pages if the last
+ * ones are short of them, at most `most` pages being in use. returns 1
+ * if there is none
+ */
+static int
+room (h, space, size, most)
+     struct yesod_heap	*h;
+     uint8_t		space;
+     uint32_t		size;
+     uint32_t		most;
+{
+  uint32_t n = (size + YESOD_HEAP_PAGE - 1) / YESOD_HEAP_PAGE, p;
+
+  if (h->limit - h->next >= size)
+    return 0;
+
+  if (h->claimed + n > most || claim (h, space, n, &p))
+    return 1;
+
+  h->next = PAGE_AT (h, p);
+  h->limit = h->next + n * YESOD_HEAP_PAGE;
+
+  return 0;
+}
+
+/*
+ * first and last page of the run of cdr-coded cells crossing the
+ * boundaries of page `p`, if any
+ */
+static void
+run_pages (h, p, lo, hi)
+     struct yesod_heap	*h;
+     uint32_t		p;
+     uint32_t		*lo;
+     uint32_t		*hi;
+{
+  uint8_t space = h->space[p];
+
+  /* a run goes on past a page whose last word is cdr-next */
+  for (*lo = p; *lo > 0 && h->space[*lo - 1] == space
+	 && h->used[*lo - 1] == YESOD_HEAP_PAGE
+	 && YESOD_CDR_CODE (h, PAGE_AT (h, *lo) - 4) == YESOD_CDR_NEXT; )
+    --*lo;
+
+  for (*hi = p; *hi + 1 < h->pages && h->space[*hi + 1] == space
+	 && h->used[*hi] == YESOD_HEAP_PAGE
+	 && YESOD_CDR_CODE (h, PAGE_AT (h, *hi + 1) - 4) == YESOD_CDR_NEXT; )
+    ++*hi;
+}
+
+/*
+ * keeps page `p` of `from` in place, moving it to the other space, with
+ * the pages of the cdr-coded runs crossing its boundaries
+ */
+static void
+keep (h, p, from)
+     struct yesod_heap	*h;
+     uint32_t		p;
+     uint8_t		from;
+{
+  uint32_t lo = p, hi = p;
+
+  if (h->space[p] != from)
+    return;
+
+  if (h->coded)
+    run_pages (h, p, &lo, &hi);
+
+  for (p = lo; p <= hi; p++)
+    {
+      h->space[p] = 3 - from;
+      h->queue[h->queued++] = p;
+      h->kept++;
+    }
+}
+
+/*
+ * first and last byte, excluded, of the cell at `w`, or of the whole
+ * run of cdr-coded cells it is part of, which may end with a normal
+ * cell
+ */
+static void
+extent (h, w, a, e)
+     struct yesod_heap	*h;
+     uint32_t		w;
+     uint32_t		*a;
+     uint32_t		*e;
+{
+  uint8_t code;
+
+  if (!h->coded)
+    {
+      *a = w;
+      *e = w + YESOD_CELL;
+      return;
+    }
+
+  for (*a = w; *a > h->base && live (h, *a - 4)
+	 && YESOD_CDR_CODE (h, *a - 4) == YESOD_CDR_NEXT; )
+    *a -= 4;
+
+  for (*e = *a;; )
+    {
+      code = YESOD_CDR_CODE (h, *e);
+      *e += code == YESOD_CDR_NORMAL ? YESOD_CELL : 4;
+
+      if (code != YESOD_CDR_NEXT || *e - h->base >= h->size || !live (h, *e))
+	break;
+    }
+}
+
+/*
+ * copies the `e - a` bytes of cells at `a` to the other space, leaving
+ * the address of the copy of every cell in its car. returns 1 if there
+ * is no room for them
+ */
+static int
+copy (vm, a, e, from)
+     struct yesod_vm	*vm;
+     uint32_t		a;
+     uint32_t		e;
+     uint8_t		from;
+{
+  struct yesod_heap	*h = &vm->cons;
+  uint8_t		*m = vm->memory.memory;
+  uint32_t		to, x, i;
+
+  if (room (h, 3 - from, e - a, h->pages))
+    return 1;
+
+  to = bump (h, e - a);
+  memcpy (m + to, m + a, e - a);
+  YESOD_COUNT_HEAP (vm, to, to + (e - a));
+
+  for (x = a; x < e; x += 4)
+    {
+      if (h->coded)
+	set_code (h, to + (x - a), YESOD_CDR_CODE (h, x));
+
+      if (h->coded ? YESOD_CDR_CODE (h, x) == YESOD_CDR_TAIL
+	  : (x - a) % YESOD_CELL)
+	continue;
+
+      i = (x - h->base) / 4;
+      YESOD_SET_LE32 (m + x, to + (x - a));
+      h->forwarded[i / 8] |= 1 << i % 8;
+    }
+
+  return 0;
+}
+
+/*
+ * `w`, a pointer, if it does not point to a cell of `from`, otherwise
+ * the address of its copy. cells that cannot be copied are kept
+ */
+static uint32_t
+forward (vm, w, from)
+     struct yesod_vm	*vm;
+     uint32_t		w;
+     uint8_t		from;
+{
+  struct yesod_heap	*h = &vm->cons;
+  uint32_t		a, e, p;
+
+  if (!cell_at (h, w))
+    return w;
+
+  /* a cell copied from a page kept later still holds its copy */
+  if (forwarded (h, w))
+    return YESOD_LE32 (vm->memory.memory + w);
+
+  if (h->space[PAGE (h, w)] != from)
+    return w;
+
+  extent (h, w, &a, &e);
+
+  if (copy (vm, a, e, from))
+    {
+      for (p = PAGE (h, a); p <= PAGE (h, e - 1); p++)
+	keep (h, p, from);
+
+      return w;
+    }
+
+  return YESOD_LE32 (vm->memory.memory + w);
+}
+
+/* keeps the page of `w`, an ambiguous word, if it points to a cell */
+static void
+ambiguous (h, w, from)
+     struct yesod_heap	*h;
+     uint32_t		w;
+     uint8_t		from;
+{
+  if (cell_at (h, w))
+    keep (h, PAGE (h, w), from);
+}
+
+/* collects the live cells into the other space, see heap.h */
+void
+yesod_heap_collect (vm)
+     struct yesod_vm *vm;
+{
+  struct yesod_heap	*h = &vm->cons;
+  uint8_t		*m = vm->memory.memory;
+  const uint32_t	mask = vm->tags.mask;
+  const uint8_t		from = h->current;
+  uint32_t		sp, i, p, a, w, x;
+  uint64_t		start = now (), pause;
+
+  for (p = 0; p < h->pages; p++)
+    if (h->space[p] == from)
+      h->scanned += h->used[p];
+
+  /* pages for the copies are claimed afresh */
+  h->next = h->limit = 0;
+  h->queued = 0;
+  h->rover = 0;
+
+  for (i = 1; i < PC; i++)
+    if ((vm->regs[i] & mask) == YESOD_TAG_CONS)
+      ambiguous (h, vm->regs[i], from);
+
+  sp = vm->regs[SP] - STACK < vm->heap ? vm->regs[SP] : vm->heap;
+
+  for (i = STACK; i + 4 <= sp; i += 4)
+    if ((YESOD_LE32 (m + i) & mask) == YESOD_TAG_CONS)
+      ambiguous (h, YESOD_LE32 (m + i), from);
+
+  /* kept pages and copies, as they are queued */
+  for (i = 0; i < h->queued; i++)
+    for (p = h->queue[i], a = PAGE_AT (h, p);
+	 a - PAGE_AT (h, p) < h->used[p]; a += 4)
+      {
+	w = YESOD_LE32 (m + a);
+
+	if ((w & mask) != YESOD_TAG_CONS)
+	  continue;
+
+	if (!mask)
+	  ambiguous (h, w, from);
+	else if ((x = forward (vm, w, from)) != w)
+	  YESOD_SET_LE32 (m + a, x);
+      }
+
+  /* what is left of `from` is free */
+  for (h->claimed = 0, p = 0; p < h->pages; p++)
+    if (h->space[p] == from)
+      h->space[p] = FREE;
+    else if (h->space[p])
+      {
+	h->claimed++;
+	h->survived += h->used[p];
+      }
+
+  memset (h->forwarded, 0, h->size / 4 / 8 + 1);
+
+  h->current = 3 - from;
+  h->collections++;
+
+  pause = now () - start;
+  h->pause += pause;
+
+  if (pause > h->max_pause)
+    h->max_pause = pause;
+}
+
+/*
+ * returns the address of `size` free bytes, collecting first if half
+ * of the pages are in use, or 0
+ */
+static uint32_t
+allocate (vm, size)
+     struct yesod_vm	*vm;
+     uint32_t		size;
+{
+  struct yesod_heap	*h = &vm->cons;
+  uint32_t		x;
+
+  if (room (h, h->current, size, h->pages / 2))
+    {
+      yesod_heap_collect (vm);
+
+      if (room (h, h->current, size, h->pages / 2))
+	return 0;
+    }
+
+  x = bump (h, size);
+  YESOD_COUNT_HEAP (vm, x, h->next);
+
+  if (!h->allocated)
+    h->first = now ();
+
+  h->allocated += size;
+
+  return x;
+}
+
+/* returns a new cell holding `car` and `cdr`, or 0 if the heap is full */
+uint32_t
+yesod_heap_cons (vm, car, cdr)
+     struct yesod_vm	*vm;
+     uint32_t		car;
+     uint32_t		cdr;
+{
+  struct yesod_heap	*h = &vm->cons;
+  uint8_t		*m = vm->memory.memory;
+  uint32_t		x;
+
+  /* the arguments are roots too */
+  vm->regs[1] = car;
+  vm->regs[2] = cdr;
+
+  if (!(x = allocate (vm, YESOD_CELL)))
+    return 0;
+
+  YESOD_SET_LE32 (m + x, vm->regs[1]);
+  YESOD_SET_LE32 (m + x + 4, vm->regs[2]);
+
+  if (h->coded)
+    {
+      set_code (h, x, YESOD_CDR_NORMAL);
+      set_code (h, x + 4, YESOD_CDR_TAIL);
+    }
+
+  return x;
+}
+
+/*
+ * returns a new list of the `n` words at `v`, CDR-coded if the heap
+ * is, or 0 if the heap is full or `n` is 0
+ */
+uint32_t
+yesod_heap_list (vm, v, n)
+     struct yesod_vm	*vm;
+     uint32_t		v;
+     uint32_t		n;
+{
+  struct yesod_heap	*h = &vm->cons;
+  uint8_t		*m = vm->memory.memory;
+  uint32_t		x, i, cell = h->coded ? 4 : YESOD_CELL;
+
+  if (!n || n > h->pages / 2 * (YESOD_HEAP_PAGE / cell)
+      || (uint64_t)v + 4 * n > vm->memory.m_size)
+    return 0;
+
+  vm->regs[1] = v;
+
+  if (!(x = allocate (vm, n * cell)))
+    return 0;
+
+  for (i = 0, v = vm->regs[1]; i < n; i++)
+    {
+      YESOD_SET_LE32 (m + x + i * cell, YESOD_LE32 (m + v + 4 * i));
+
+      if (h->coded)
+	set_code (h, x + 4 * i, i + 1 < n ? YESOD_CDR_NEXT : YESOD_CDR_NIL);
+      else
+	YESOD_SET_LE32 (m + x + i * cell + 4, i + 1 < n ? x + (i + 1) * cell : 0);
+    }
+
+  return x;
+}
+
+/* bytes allocated per second since the first allocation */
+double
+yesod_heap_rate (vm)
+     struct yesod_vm *vm;
+{
+  struct yesod_heap	*h = &vm->cons;
+  uint64_t		t;
+
+  if (!h->allocated)
+    return 0;
+
+  t = now () - h->first;
+
+  return (double)h->allocated * 1e9 / (t ? t : 1);
+}
+
+void
+yesod_heap_destroy (vm)
+     struct yesod_vm *vm;
+{
+  free (vm->cons.space);
+  free (vm->cons.used);
+  free (vm->cons.queue);
+  free (vm->cons.forwarded);
+  free (vm->cons.codes);
+  vm->cons.space = NULL;
+  vm->cons.used = NULL;
+  vm->cons.queue = NULL;
+  vm->cons.forwarded = NULL;
+  vm->cons.codes = NULL;
+}
@@ -0,0 +1,98 @@
+#ifndef YESOD_HEAP_
+# define YESOD_HEAP_
+
+# include <stdbool.h>
+# include <stdint.h>
+
+struct yesod_vm;
+
+/* bytes of a cons cell, its car at `x` and its cdr at `x + 4` */
+# define YESOD_CELL (8)
+
+/* cdr codes, see below */
+# define YESOD_CDR_NORMAL (0)	/* car of a cell, its cdr in the next word */
+# define YESOD_CDR_NEXT   (1)	/* the cdr is the next word */
+# define YESOD_CDR_NIL    (2)	/* the cdr is 0 */
+# define YESOD_CDR_TAIL   (3)	/* cdr of a normal cell */
+
+/* bytes of a page of the heap, a multiple of YESOD_CELL */
+# define YESOD_HEAP_PAGE (256)
+
+/*
+ * native cons heap
+ *
+ * the heap, from `vm->heap` up to .rodata, is split into pages, each
+ * either free or in the current space. cells are allocated by bumping
+ * `next` through the pages last claimed, and once half of the pages
+ * are in use the live cells are collected into the other space,
+ * breadth first (Bartlett's mostly-copying collector)
+ *
+ * the roots are x1 to x13 and the words of the stack below sp. they
+ * are ambiguous, as any word holding the address of a cell may be an
+ * integer: the pages they point to are kept in place, in the other
+ * space, and they are never rewritten. in tagged mode (see tags.h),
+ * the words of cells tagged cons are pointers, and the cells they
+ * point to are copied unless their page is kept. out of it, the words
+ * of cells are ambiguous too, so that no cell moves and whole pages
+ * are reclaimed. a dead cell in a kept page keeps what it points to
+ *
+ * if `coded` is set, lists may be CDR-coded: every word of the heap
+ * has a 2 bit code, and a cdr-next or cdr-nil word is a whole cell
+ * whose cdr is not stored, CDR resolving it to the next word or to 0.
+ * such lists take half the memory and are laid out in order. runs of
+ * cdr-next words, which may span pages, are kept or copied whole, so
+ * they stay contiguous. storing into the cdr of a cdr-coded cell
+ * overwrites the next one
+ */
+struct yesod_heap {
+  bool		coded;
+  uint32_t	base;		/* `vm->heap` */
+  uint32_t	size;		/* bytes, a multiple of YESOD_HEAP_PAGE */
+  uint32_t	pages;
+  uint32_t	claimed;	/* pages of the current space */
+  uint32_t	rover;		/* where the search for free pages starts */
+  uint8_t	current;	/* space of the pages in use, 1 or 2 */
+  uint32_t	next;		/* first free byte of the pages last claimed */
+  uint32_t	limit;		/* end of them */
+  uint8_t	*space;		/* of every page, 0 if it is free */
+  uint16_t	*used;		/* bytes allocated at the start of each page */
+  uint32_t	*queue;		/* pages moved to the other space */
+  uint32_t	queued;
+  uint8_t	*forwarded;	/* one bit per word */
+  uint8_t	*codes;		/* four per byte if `coded`, from `base` */
+
+  uint64_t	allocated;	/* bytes */
+  uint64_t	collections;
+  uint64_t	scanned;	/* bytes in use before the collections */
+  uint64_t	survived;	/* bytes copied or kept by them */
+  uint64_t	kept;		/* pages kept in place */
+  uint64_t	pause;		/* ns spent collecting */
+  uint64_t	max_pause;
+  uint64_t	first;		/* ns timestamp of the first allocation */
+};
+
+/* code of the word at `a`, in the heap */
+# define YESOD_CDR_CODE(h, a)						\
+  (((h)->codes[((a) - (h)->base) >> 4]					\
+    >> ((((a) - (h)->base) >> 1) & 6)) & 3)
+
+/* code of the cell at `x`, cdr-normal outside of a CDR-coded heap */
+# define YESOD_CDR(h, x)						\
+  ((h)->coded && (uint32_t)((x) - (h)->base) < (h)->size		\
+   && !(((x) - (h)->base) & 3)						\
+   ? YESOD_CDR_CODE (h, x) : YESOD_CDR_NORMAL)
+
+/* true if the cdr of a cell of code `c` is not stored */
+# define YESOD_CDR_CODED(c) ((unsigned)((c) - YESOD_CDR_NEXT) < 2)
+
+/* cdr of the cell at `x` of code `c`, cdr-next or cdr-nil */
+# define YESOD_CDR_OF(c, x) ((c) == YESOD_CDR_NEXT ? (x) + 4 : 0)
+
+int		yesod_heap_init (struct yesod_vm *);
+uint32_t	yesod_heap_cons (struct yesod_vm *, uint32_t, uint32_t);
+uint32_t	yesod_heap_list (struct yesod_vm *, uint32_t, uint32_t);
+void		yesod_heap_collect (struct yesod_vm *);
+double		yesod_heap_rate (struct yesod_vm *);
+void		yesod_heap_destroy (struct yesod_vm *);
+
+#endif /* YESOD_HEAP_ */
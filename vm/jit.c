@@ -0,0 +1,890 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include "jit.h"
+#include "vm.h"
+
+#if defined (__x86_64__) && defined (__GNUC__)
+
+# include <sys/mman.h>
+
+/*
+ * x86-64 backend
+ *
+ * the compiled code keeps the VM pointer in rbx and guest memory in
+ * r12. guest registers and flags stay in the VM, so that the
+ * interpreter can take over anywhere in a block; eax, ecx and edx are
+ * scratch. flags are kept pending in `lazy` as the interpreters do
+ */
+
+# define EAX (0)
+# define ECX (1)
+# define EDX (2)
+# define EBX (3)
+
+# define CC_B  (0x2)
+# define CC_AE (0x3)
+# define CC_Z  (0x4)
+# define CC_NZ (0x5)
+# define CC_BE (0x6)
+# define CC_A  (0x7)
+
+# define SHL (4)
+# define SHR (5)
+# define SAR (7)
+
+# define OP_ADD (0x01)
+# define OP_OR  (0x09)
+# define OP_AND (0x21)
+# define OP_SUB (0x29)
+# define OP_XOR (0x31)
+# define OP_CMP (0x39)
+
+# define REG(i)	((int32_t)(offsetof (struct yesod_vm, regs) + 4 * (i)))
+# define FLAGS	((int32_t)offsetof (struct yesod_vm, flags))
+# define LAZY(f)	((int32_t)offsetof (struct yesod_vm, lazy.f))
+# define MEMORY	((int32_t)offsetof (struct yesod_vm, memory.memory))
+# define COUNTER(f)	((int32_t)offsetof (struct yesod_vm, counters.f))
+
+/* upper bound on the code emitted for a block */
+# define CODE_MAX (YESOD_BLOCK_MAX * 256 + 64)
+
+# define MODRM(mod, reg, rm) ((uint8_t)(((mod) << 6) | ((reg) << 3) | (rm)))
+
+/* same condition encoding as in threaded.c, without TAG */
+static const uint8_t cond_flag[8] = {
+  0, FLAG_NIL, FLAG_CARRY, FLAG_CARRY, FLAG_NIL, 0, FLAG_OVER, FLAG_OVER
+};
+static const uint8_t cond_set[8] = {
+  0, 1, 1, 0, 0, 0, 0, 1
+};
+
+static uint8_t *
+b1 (c, x)
+     uint8_t	*c;
+     uint8_t	x;
+{
+  *c++ = x;
+
+  return c;
+}
+
+static uint8_t *
+b4 (c, x)
+     uint8_t	*c;
+     uint32_t	x;
+{
+  *c++ = (uint8_t)x;
+  *c++ = (uint8_t)(x >> 8);
+  *c++ = (uint8_t)(x >> 16);
+  *c++ = (uint8_t)(x >> 24);
+
+  return c;
+}
+
+/* op r32, [rbx + disp] */
+static uint8_t *
+mem (c, opc, r, disp)
+     uint8_t	*c;
+     uint8_t	opc;
+     int	r;
+     int32_t	disp;
+{
+  c = b1 (c, opc);
+  c = b1 (c, MODRM (2, r, EBX));
+
+  return b4 (c, disp);
+}
+
+# define LOAD(c, r, disp)  mem ((c), 0x8B, (r), (disp))
+# define STORE(c, r, disp) mem ((c), 0x89, (r), (disp))
+
+/* mov dword [rbx + disp], imm */
+static uint8_t *
+store_imm (c, disp, x)
+     uint8_t	*c;
+     int32_t	disp;
+     uint32_t	x;
+{
+  c = mem (c, 0xC7, 0, disp);
+
+  return b4 (c, x);
+}
+
+/* inc qword [rbx + disp] */
+static uint8_t *
+count (c, disp)
+     uint8_t	*c;
+     int32_t	disp;
+{
+  c = b1 (c, 0x48);
+
+  return mem (c, 0xFF, 0, disp);
+}
+
+/* op r32, r32 */
+static uint8_t *
+alu (c, opc, dst, src)
+     uint8_t	*c;
+     uint8_t	opc;
+     int	dst;
+     int	src;
+{
+  c = b1 (c, opc);
+
+  return b1 (c, MODRM (3, src, dst));
+}
+
+/* op r32, imm, `ext` selecting add (0), or (1), sub (5) or cmp (7) */
+static uint8_t *
+alu_imm (c, ext, r, x)
+     uint8_t	*c;
+     int	ext;
+     int	r;
+     uint32_t	x;
+{
+  c = b1 (c, 0x81);
+  c = b1 (c, MODRM (3, ext, r));
+
+  return b4 (c, x);
+}
+
+static uint8_t *
+mov_imm (c, r, x)
+     uint8_t	*c;
+     int	r;
+     uint32_t	x;
+{
+  c = b1 (c, 0xB8 + r);
+
+  return b4 (c, x);
+}
+
+static uint8_t *
+setcc (c, cc, r)
+     uint8_t	*c;
+     int	cc;
+     int	r;
+{
+  c = b1 (c, 0x0F);
+  c = b1 (c, 0x90 + cc);
+
+  return b1 (c, MODRM (3, 0, r));
+}
+
+/* jcc rel32, returns where the offset is to be patched */
+static uint8_t *
+jcc (c, cc, at)
+     uint8_t	*c;
+     int	cc;
+     uint8_t	**at;
+{
+  c = b1 (c, 0x0F);
+  c = b1 (c, 0x80 + cc);
+  *at = c;
+
+  return b4 (c, 0);
+}
+
+static uint8_t *
+jmp (c, at)
+     uint8_t	*c;
+     uint8_t	**at;
+{
+  c = b1 (c, 0xE9);
+  *at = c;
+
+  return b4 (c, 0);
+}
+
+static void
+patch (at, target)
+     uint8_t	*at;
+     uint8_t	*target;
+{
+  b4 (at, (uint32_t)(target - (at + 4)));
+}
+
+/* returns `x` to the engine */
+static uint8_t *
+leave (c, x)
+     uint8_t	*c;
+     uint32_t	x;
+{
+  c = mov_imm (c, EAX, x);
+  c = b1 (c, 0x41);		/* pop r12 */
+  c = b1 (c, 0x5C);
+  c = b1 (c, 0x5B);		/* pop rbx */
+
+  return b1 (c, 0xC3);		/* ret */
+}
+
+/* NIL and SIGN of edx, as `LAZY_RESULT` */
+static uint8_t *
+flagset (c)
+     uint8_t *c;
+{
+  c = alu (c, 0x85, EDX, EDX);		/* test edx, edx */
+  c = setcc (c, CC_Z, EAX);
+  c = mem (c, 0x08, EAX, LAZY (nil));	/* or [nil], al */
+
+  return mem (c, 0x09, EDX, LAZY (sign));	/* or [sign], edx */
+}
+
+/*
+ * CARRY and OVER of `a + src`, a in edx and src in eax, leaving the
+ * sum in edx
+ */
+static uint8_t *
+addition (c)
+     uint8_t *c;
+{
+  c = alu (c, 0x89, ECX, EDX);		/* mov ecx, edx */
+  c = alu (c, OP_AND, ECX, EAX);
+  c = mem (c, 0x09, ECX, LAZY (carry));	/* or [carry], ecx */
+  c = alu (c, 0x89, ECX, EDX);
+  c = alu (c, OP_ADD, EDX, EAX);
+  c = alu (c, OP_XOR, ECX, EDX);		/* a ^ x */
+  c = alu (c, OP_XOR, EAX, EDX);		/* src ^ x */
+  c = alu (c, OP_AND, ECX, EAX);
+
+  return mem (c, 0x09, ECX, LAZY (over));
+}
+
+/*
+ * CARRY and OVER of `a - src`, a in edx and src in eax, leaving the
+ * difference in edx
+ */
+static uint8_t *
+subtract (c)
+     uint8_t *c;
+{
+  c = alu (c, OP_XOR, ECX, ECX);
+  c = alu (c, OP_CMP, EAX, EDX);	/* cmp eax, edx */
+  c = setcc (c, CC_B, ECX);		/* src < a */
+  c = b1 (c, 0xC1);			/* shl ecx, 31 */
+  c = b1 (c, MODRM (3, SHL, ECX));
+  c = b1 (c, 31);
+  c = mem (c, 0x09, ECX, LAZY (carry));
+  c = alu (c, 0x89, ECX, EDX);
+  c = alu (c, OP_SUB, EDX, EAX);
+  c = alu (c, OP_XOR, EAX, ECX);	/* a ^ src */
+  c = alu (c, OP_XOR, ECX, EDX);	/* a ^ x */
+  c = alu (c, OP_AND, ECX, EAX);
+
+  return mem (c, 0x09, ECX, LAZY (over));
+}
+
+/*
+ * the flag tested by `cond` in bit `cond_flag[cond]` of al, along with
+ * the flags already worked out
+ */
+static uint8_t *
+condition (c, cond)
+     uint8_t	*c;
+     int	cond;
+{
+  switch (cond_flag[cond])
+    {
+    case FLAG_NIL:
+      c = mem (c, 0x83, 7, LAZY (nil));	/* cmp dword [nil], 0 */
+      c = b1 (c, 0);
+      c = setcc (c, CC_NZ, EAX);
+      break;
+    case FLAG_CARRY:
+      c = LOAD (c, EAX, LAZY (carry));
+      c = b1 (c, 0xC1);			/* shr eax, 30 */
+      c = b1 (c, MODRM (3, SHR, EAX));
+      c = b1 (c, 30);
+      break;
+    case FLAG_OVER:
+      c = LOAD (c, EAX, LAZY (over));
+      c = b1 (c, 0xC1);			/* shr eax, 28 */
+      c = b1 (c, MODRM (3, SHR, EAX));
+      c = b1 (c, 28);
+      break;
+    }
+
+  c = mem (c, 0x0A, EAX, FLAGS);	/* or al, [flags] */
+  c = b1 (c, 0xA8);			/* test al, imm */
+
+  return b1 (c, cond_flag[cond]);
+}
+
+static bool
+reads_pc (op)
+     const struct yesod_op *op;
+{
+  if (op->ra == PC)
+    return true;
+
+  switch (op->class)
+    {
+    case INSTR_CLASS1:
+      return op->rb == PC || (!(op->bits & OP_SHIFTI) && op->imm == PC);
+    case INSTR_CLASS3:
+      return !(op->bits & OP_SHIFTI) && op->imm == PC;
+    }
+
+  return false;
+}
+
+static bool
+writes_x0 (op)
+     const struct yesod_op *op;
+{
+  return op->opcode == CMP || op->ra == 0;
+}
+
+/* true if the instruction has a native translation */
+static bool
+supported (op)
+     const struct yesod_op *op;
+{
+  switch (op->class)
+    {
+    case INSTR_CLASS1:
+      if (op->opcode == NOP)
+	return true;
+      /* fall through */
+    case INSTR_CLASS2:
+      return (op->opcode >= MOV && op->opcode <= STR) || op->opcode == CMP;
+    case INSTR_CLASS3:
+    case INSTR_CLASS4:
+      return op->opcode == JA || op->opcode == JR;
+    }
+
+  return false;
+}
+
+/* loads the source operand of `op` into eax */
+static uint8_t *
+operand (c, op)
+     uint8_t			*c;
+     const struct yesod_op	*op;
+{
+  switch (op->class)
+    {
+    case INSTR_CLASS2:
+      return mov_imm (c, EAX, (uint32_t)op->imm << ((op->bits & OP_UPLO) ? 16 : 0));
+    case INSTR_CLASS4:
+      c = LOAD (c, EAX, REG (op->ra));
+      c = b1 (c, 0xC1);
+      c = b1 (c, MODRM (3, SHL, EAX));
+      c = b1 (c, 16);
+      return alu_imm (c, 1, EAX, op->imm);
+    }
+
+  c = LOAD (c, EAX, REG (op->class == INSTR_CLASS1 ? op->rb : op->ra));
+
+  if (op->shift != NONE)
+    {
+      static const int ext[4] = {0, SHL, SHR, SAR};
+
+      if (op->bits & OP_SHIFTI)
+	{
+	  c = b1 (c, 0xC1);
+	  c = b1 (c, MODRM (3, ext[op->shift], EAX));
+	  c = b1 (c, op->imm);
+	}
+      else
+	{
+	  /* the count is masked to 5 bits, as with the C shifts */
+	  c = LOAD (c, ECX, REG (op->imm));
+	  c = b1 (c, 0xD3);
+	  c = b1 (c, MODRM (3, ext[op->shift], EAX));
+	}
+    }
+
+  switch (op->size)
+    {
+    case DAY:
+      c = b1 (c, 0x25);		/* and eax, imm */
+      c = b4 (c, 0x00FFFFFF);
+      break;
+    case HALF:
+      c = b1 (c, 0x0F);		/* movzx eax, ax */
+      c = b1 (c, 0xB7);
+      c = b1 (c, 0xC0);
+      break;
+    case BYTE:
+      c = b1 (c, 0x0F);		/* movzx eax, al */
+      c = b1 (c, 0xB6);
+      c = b1 (c, 0xC0);
+      break;
+    }
+
+  return c;
+}
+
+/* the bytes CAR, CDR and STR access, as YESOD_LEN_* */
+static uint32_t
+length (op)
+     const struct yesod_op *op;
+{
+  static const uint32_t bytes[4] = {4, 3, 2, 1};
+
+  return op->class == INSTR_CLASS1 ? bytes[op->size] : 4;
+}
+
+/* edx = the `len` bytes at [r12 + rax], little-endian */
+static uint8_t *
+load_guest (c, len)
+     uint8_t	*c;
+     uint32_t	len;
+{
+  c = b1 (c, 0x41);
+  c = b1 (c, len == 4 ? 0x8B : 0x0F);
+
+  if (len != 4)
+    c = b1 (c, len == 1 ? 0xB6 : 0xB7);	/* movzx edx, byte or word */
+
+  c = b1 (c, 0x14);
+  c = b1 (c, 0x04);
+
+  if (len == 3)
+    {
+      c = b1 (c, 0x41);			/* movzx ecx, byte [r12 + rax + 2] */
+      c = b1 (c, 0x0F);
+      c = b1 (c, 0xB6);
+      c = b1 (c, 0x4C);
+      c = b1 (c, 0x04);
+      c = b1 (c, 2);
+      c = b1 (c, 0xC1);			/* shl ecx, 16 */
+      c = b1 (c, MODRM (3, SHL, ECX));
+      c = b1 (c, 16);
+      c = alu (c, OP_OR, EDX, ECX);
+    }
+
+  return c;
+}
+
+/* [r12 + rdx] = the `len` low bytes of eax, little-endian */
+static uint8_t *
+store_guest (c, len)
+     uint8_t	*c;
+     uint32_t	len;
+{
+  if (len == 2 || len == 3)
+    c = b1 (c, 0x66);			/* operand size prefix */
+
+  c = b1 (c, 0x41);
+  c = b1 (c, len == 1 ? 0x88 : 0x89);
+  c = b1 (c, 0x04);
+  c = b1 (c, 0x14);
+
+  if (len == 3)
+    {
+      c = b1 (c, 0xC1);			/* shr eax, 16 */
+      c = b1 (c, MODRM (3, SHR, EAX));
+      c = b1 (c, 16);
+      c = b1 (c, 0x41);			/* mov [r12 + rdx + 2], al */
+      c = b1 (c, 0x88);
+      c = b1 (c, 0x44);
+      c = b1 (c, 0x14);
+      c = b1 (c, 2);
+    }
+
+  return c;
+}
+
+/* `bail` receives the jumps to take to leave before the instruction */
+static uint8_t *
+instruction (c, vm, op, pc, bail, nbail)
+     uint8_t			*c;
+     struct yesod_vm		*vm;
+     const struct yesod_op	*op;
+     uint32_t			pc;
+     uint8_t			**bail;
+     int			*nbail;
+{
+  uint32_t	base = vm->decoded.base, size = vm->decoded.size;
+  uint32_t	len = length (op);
+  uint8_t	*skip[3];
+
+  if (op->class == INSTR_CLASS1 && op->opcode == NOP)
+    return c;
+
+  c = operand (c, op);
+
+  if (op->class == INSTR_CLASS3 || op->class == INSTR_CLASS4)
+    {
+      if (op->bits & OP_PUSH)
+	{
+	  /* overflows and pushes into .text are left to the interpreter */
+	  c = LOAD (c, ECX, REG (SP));
+	  c = alu_imm (c, 7, ECX, vm->memory.s_size);
+	  c = jcc (c, CC_A, &bail[(*nbail)++]);
+	  c = alu (c, 0x89, EDX, ECX);		/* mov edx, ecx */
+	  c = alu_imm (c, 5, EDX, base);
+	  c = alu_imm (c, 7, EDX, size);
+	  c = jcc (c, CC_B, &bail[(*nbail)++]);
+	  c = alu_imm (c, 0, EDX, 3);
+	  c = alu_imm (c, 7, EDX, size);
+	  c = jcc (c, CC_B, &bail[(*nbail)++]);
+
+	  c = mov_imm (c, EDX, pc + 4);
+	  c = b1 (c, 0x41);			/* mov [r12 + rcx], edx */
+	  c = b1 (c, 0x89);
+	  c = b1 (c, 0x14);
+	  c = b1 (c, 0x0C);
+	  c = mem (c, 0x83, 0, REG (SP));	/* add dword [sp], 4 */
+	  c = b1 (c, 4);
+	  c = count (c, COUNTER (pushes));
+	  c = count (c, COUNTER (writes));
+	}
+
+      /* JR lands at `pc + 4 + src - 4` */
+      if (op->opcode == JR)
+	c = alu_imm (c, 0, EAX, pc);
+
+      return STORE (c, EAX, REG (PC));
+    }
+
+  switch (op->opcode)
+    {
+    case MOV:
+      c = alu (c, 0x89, EDX, EAX);		/* mov edx, eax */
+      break;
+    case ADD:
+      c = LOAD (c, EDX, REG (op->ra));
+      c = addition (c);
+      break;
+    case SUB:
+    case CMP:
+      c = LOAD (c, EDX, REG (op->ra));
+      c = subtract (c);
+      break;
+    case AND:
+    case OR:
+    case XOR:
+      c = LOAD (c, EDX, REG (op->ra));
+      c = alu (c, op->opcode == AND ? OP_AND : op->opcode == OR ? OP_OR : OP_XOR,
+	       EDX, EAX);
+      break;
+    case CAR:
+    case CDR:
+      /* the address wraps around as in the interpreters */
+      if (op->opcode == CDR)
+	c = alu_imm (c, 0, EAX, sizeof (uint32_t));
+
+      c = load_guest (c, len);
+      c = count (c, COUNTER (reads));
+      break;
+    case STR:
+      /*
+       * stores touching .text are left to the interpreter, and so are
+       * the ones that mark cards, once marking is on (see cards.h). the
+       * `len` bytes at edx touch .text if edx lies within
+       * [base - len + 1, base + size)
+       */
+      c = LOAD (c, EDX, REG (op->ra));
+      c = alu (c, 0x89, ECX, EDX);		/* mov ecx, edx */
+      c = alu_imm (c, 5, ECX, base - (len - 1));
+      c = alu_imm (c, 7, ECX, size + (len - 1));
+      c = jcc (c, CC_B, &bail[(*nbail)++]);
+
+      if (vm->cards.size)
+	{
+	  c = alu (c, 0x89, ECX, EDX);		/* mov ecx, edx */
+	  c = alu_imm (c, 5, ECX, vm->cards.base);
+	  c = alu_imm (c, 7, ECX, vm->cards.size);
+	  c = jcc (c, CC_B, &bail[(*nbail)++]);
+	}
+
+      c = store_guest (c, len);
+      c = count (c, COUNTER (writes));
+
+      /* the heap extent, as YESOD_COUNT_HEAP */
+      c = alu (c, 0x89, ECX, EDX);		/* mov ecx, edx */
+      c = alu_imm (c, 0, ECX, len);
+      c = mem (c, 0x3B, ECX, COUNTER (heap));	/* cmp ecx, [heap] */
+      c = jcc (c, CC_BE, &skip[0]);
+      c = alu_imm (c, 7, EDX, vm->heap);
+      c = jcc (c, CC_B, &skip[1]);
+      c = alu_imm (c, 7, EDX, vm->rodata);
+      c = jcc (c, CC_AE, &skip[2]);
+      c = STORE (c, ECX, COUNTER (heap));
+      patch (skip[0], c);
+      patch (skip[1], c);
+      patch (skip[2], c);
+      return c;
+    }
+
+  c = STORE (c, EDX, REG (op->opcode == CMP ? 0 : op->ra));
+
+  return flagset (c);
+}
+
+/* drops the native code of every block */
+void
+yesod_jit_flush (vm)
+     struct yesod_vm *vm;
+{
+  uint32_t i;
+
+  for (i = 0; i < vm->blocks.capacity; i++)
+    {
+      vm->blocks.ring[i].native = NULL;
+      vm->blocks.ring[i].hits = 0;
+    }
+
+  vm->jit.used = 0;
+  vm->jit.npcs = 0;
+}
+
+/* true if the instruction may fault on guest memory */
+static bool
+accesses (op)
+     const struct yesod_op *op;
+{
+  if (op->class == INSTR_CLASS3 || op->class == INSTR_CLASS4)
+    return op->bits & OP_PUSH;
+
+  return op->opcode == CAR || op->opcode == CDR || op->opcode == STR;
+}
+
+/* true if the instruction traps on, or tests, tags */
+static bool
+tagged (op)
+     const struct yesod_op *op;
+{
+  if (op->cond == TAG)
+    return true;
+
+  if (op->class == INSTR_CLASS3 || op->class == INSTR_CLASS4)
+    return false;
+
+  return op->opcode == CAR || op->opcode == CDR || op->opcode == CMP;
+}
+
+int
+yesod_jit_init (vm)
+     struct yesod_vm *vm;
+{
+  void *p;
+
+  vm->jit.arena = NULL;
+  vm->jit.used = 0;
+  vm->jit.pcs = NULL;
+  vm->jit.npcs = 0;
+  vm->jit.compiled = vm->jit.native = 0;
+
+  if (!vm->jit.enabled)
+    return 0;
+
+  p = mmap (NULL, YESOD_JIT_ARENA, PROT_READ | PROT_WRITE | PROT_EXEC,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  vm->jit.pcs = malloc (YESOD_JIT_PCS * sizeof (struct yesod_jit_pc));
+
+  /* not fatal, the interpreter runs everything */
+  if (p == MAP_FAILED || !vm->jit.pcs)
+    {
+      if (p != MAP_FAILED)
+	munmap (p, YESOD_JIT_ARENA);
+
+      free (vm->jit.pcs);
+      vm->jit.pcs = NULL;
+      vm->jit.enabled = false;
+      return 0;
+    }
+
+  vm->jit.arena = p;
+
+  return 0;
+}
+
+void
+yesod_jit_compile (vm, b)
+     struct yesod_vm	*vm;
+     struct yesod_block	*b;
+{
+  struct yesod_jit		*j = &vm->jit;
+  const struct yesod_op		*op;
+  uint8_t			*start, *c, *skip, *over, *bail[3];
+  int				nbail, k;
+  uint32_t			i, pc;
+  bool				x0 = true;
+
+  if (!j->enabled || !b->id)
+    return;
+
+  if (j->used + CODE_MAX > YESOD_JIT_ARENA
+      || j->npcs + YESOD_BLOCK_MAX > YESOD_JIT_PCS)
+    yesod_jit_flush (vm);
+
+  c = start = j->arena + j->used;
+
+  c = b1 (c, 0x53);		/* push rbx */
+  c = b1 (c, 0x41);		/* push r12 */
+  c = b1 (c, 0x54);
+  c = b1 (c, 0x48);		/* mov rbx, rdi */
+  c = b1 (c, 0x89);
+  c = b1 (c, 0xFB);
+  c = b1 (c, 0x4C);		/* mov r12, [rbx + memory] */
+  c = b1 (c, 0x8B);
+  c = b1 (c, MODRM (2, 4, EBX));
+  c = b4 (c, MEMORY);
+
+  for (i = 0, pc = b->pc; i < b->len; i++, pc += 4)
+    {
+      op = &b->ops[i];
+
+      /*
+       * checked accesses are left to the interpreter, see tlb.h, and
+       * so are CDRs of CDR-coded cells, see heap.h, and whatever deals
+       * with tags, see tags.h
+       */
+      if (!supported (op) || (vm->tlb.enabled && accesses (op))
+	  || (vm->cons.coded && op->opcode == CDR)
+	  || (vm->tags.mask && tagged (op)))
+	{
+	  c = leave (c, i + 1);
+	  goto done;
+	}
+
+      if (accesses (op))
+	{
+	  j->pcs[j->npcs].offset = c - j->arena;
+	  j->pcs[j->npcs++].pc = pc;
+	}
+
+      /* x0 reads 0 unless the previous instruction wrote to it */
+      if (x0)
+	c = store_imm (c, REG (0), 0);
+
+      if (i == b->len - 1 || reads_pc (op))
+	c = store_imm (c, REG (PC), pc + 4);
+
+      skip = NULL;
+      nbail = 0;
+
+      if (cond_flag[op->cond])
+	{
+	  c = condition (c, op->cond);
+	  c = jcc (c, cond_set[op->cond] ? CC_Z : CC_NZ, &skip);
+	}
+
+      c = instruction (c, vm, op, pc, bail, &nbail);
+
+      if (nbail)
+	{
+	  c = jmp (c, &over);
+
+	  for (k = 0; k < nbail; k++)
+	    patch (bail[k], c);
+
+	  c = leave (c, i + 1);
+	  patch (over, c);
+	}
+
+      if (skip)
+	patch (skip, c);
+
+      x0 = writes_x0 (op);
+    }
+
+  c = leave (c, 0);
+
+ done:
+  j->used += c - start;
+  j->compiled++;
+  b->native = (yesod_native)start;
+}
+
+/* the guest instruction of the native code at `ip`, if there is one */
+bool
+yesod_jit_pc (vm, ip, pc)
+     struct yesod_vm	*vm;
+     uintptr_t		ip;
+     uint32_t		*pc;
+{
+  struct yesod_jit	*j = &vm->jit;
+  uint32_t		lo = 0, hi = j->npcs, mid;
+
+  if (!j->arena || ip < (uintptr_t)j->arena || ip >= (uintptr_t)j->arena + j->used)
+    return false;
+
+  /* the last instruction starting at or before `ip` */
+  while (hi - lo > 1)
+    {
+      mid = (lo + hi) / 2;
+
+      if (j->pcs[mid].offset <= ip - (uintptr_t)j->arena)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  if (!j->npcs || j->pcs[lo].offset > ip - (uintptr_t)j->arena)
+    return false;
+
+  *pc = j->pcs[lo].pc;
+
+  return true;
+}
+
+void
+yesod_jit_destroy (vm)
+     struct yesod_vm *vm;
+{
+  if (vm->jit.arena)
+    munmap (vm->jit.arena, YESOD_JIT_ARENA);
+
+  free (vm->jit.pcs);
+  vm->jit.arena = NULL;
+  vm->jit.pcs = NULL;
+}
+
+#else /* !__x86_64__ */
+
+int
+yesod_jit_init (vm)
+     struct yesod_vm *vm;
+{
+  vm->jit.enabled = false;
+  vm->jit.arena = NULL;
+  vm->jit.used = 0;
+  vm->jit.pcs = NULL;
+  vm->jit.npcs = 0;
+  vm->jit.compiled = vm->jit.native = 0;
+
+  return 0;
+}
+
+void
+yesod_jit_compile (vm, b)
+     struct yesod_vm	*vm;
+     struct yesod_block	*b;
+{
+  (void)vm;
+  (void)b;
+}
+
+bool
+yesod_jit_pc (vm, ip, pc)
+     struct yesod_vm	*vm;
+     uintptr_t		ip;
+     uint32_t		*pc;
+{
+  (void)vm;
+  (void)ip;
+  (void)pc;
+
+  return false;
+}
+
+void
+yesod_jit_flush (vm)
+     struct yesod_vm *vm;
+{
+  (void)vm;
+}
+
+void
+yesod_jit_destroy (vm)
+     struct yesod_vm *vm;
+{
+  (void)vm;
+}
+
+#endif /* __x86_64__ */
@@ -0,0 +1,64 @@
+#ifndef YESOD_JIT_
+# define YESOD_JIT_
+
+# include <stdbool.h>
+# include <stddef.h>
+# include <stdint.h>
+
+struct yesod_vm;
+struct yesod_block;
+
+/* number of runs after which a block is compiled */
+# ifndef YESOD_JIT_THRESHOLD
+#  define YESOD_JIT_THRESHOLD (16)
+# endif
+
+/* size of the executable arena */
+# ifndef YESOD_JIT_ARENA
+#  define YESOD_JIT_ARENA (1 << 20)
+# endif
+
+/*
+ * compiled block
+ *
+ * returns 0 if the whole block ran, x14 then holding the next pc, or
+ * `i + 1` if it stopped right before its `i`th instruction, which is
+ * left to the interpreter along with the rest of the block
+ */
+typedef uint32_t (*yesod_native) (struct yesod_vm *);
+
+/* guest instruction whose native code starts at `offset` in the arena */
+struct yesod_jit_pc {
+  uint32_t	offset;
+  uint32_t	pc;
+};
+
+/* entries of the map of the instructions that access memory */
+# define YESOD_JIT_PCS (YESOD_JIT_ARENA / 16)
+
+/*
+ * x86-64 compiler for hot blocks
+ *
+ * native code is appended to `arena` until it is full, at which point
+ * every block loses its native code and the arena starts over. `pcs`
+ * maps the native code of the instructions that access memory back to
+ * them, in order, for faults (see fault.h)
+ */
+struct yesod_jit {
+  bool			enabled;
+  uint8_t		*arena;
+  size_t		used;
+  struct yesod_jit_pc	*pcs;
+  uint32_t		npcs;
+
+  uint64_t		compiled;
+  uint64_t		native;		/* instructions run natively */
+};
+
+int	yesod_jit_init (struct yesod_vm *);
+void	yesod_jit_compile (struct yesod_vm *, struct yesod_block *);
+bool	yesod_jit_pc (struct yesod_vm *, uintptr_t, uint32_t *);
+void	yesod_jit_flush (struct yesod_vm *);
+void	yesod_jit_destroy (struct yesod_vm *);
+
+#endif /* YESOD_JIT_ */
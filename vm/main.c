@@ -1,9 +1,11 @@
 #include <getopt.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include "vm.h"
-#include "cycle.h"
+#include "run.h"
 
 int
 main (argc, argv)
@@ -11,30 +13,96 @@ main (argc, argv)
      char *const argv[];
 {
   struct yesod_vm	vm;
-  int			opt;
+  int			opt, i;
   uint32_t		mem = 4096, stack = 32 * 4;
-  uint32_t		ret;
+  uint32_t		blocks = YESOD_BLOCKS_DEFAULT, tags = 0, latency = 0;
+  uint64_t		budget = YESOD_UNLIMITED;
+  struct yesod_stop	stop;
+  bool			threaded = false, jit = true, strict = false;
+  bool			protect = false, checked = false, coded = false;
+  bool			pipe = false;
+  struct yesod_cache	icache, dcache;
+  const char		*folded = NULL, *counters = NULL;
+  struct yesod_trace	trace;
   FILE			*f;
 
-  while ((opt = getopt (argc, argv, "m:s:")) != -1)
+  memset (&icache, 0, sizeof (icache));
+  memset (&dcache, 0, sizeof (dcache));
+  memset (&trace, 0, sizeof (trace));
+
+  while ((opt = getopt (argc, argv, "b:c:D:F:I:j:JLMm:P:ps:T:tVx:X:")) != -1)
     {
       switch (opt)
 	{
+	case 'b':
+	  budget = strtoul (optarg, NULL, 10);
+	  if (!budget)
+	    budget = YESOD_UNLIMITED;
+	  break;
+	case 'c':
+	  blocks = strtoul (optarg, NULL, 10);
+	  break;
+	case 'D':
+	  if (yesod_cache_parse (&dcache, optarg))
+	    return EXIT_FAILURE;
+	  break;
+	case 'F':
+	  folded = optarg;
+	  break;
+	case 'I':
+	  if (yesod_cache_parse (&icache, optarg))
+	    return EXIT_FAILURE;
+	  break;
+	case 'j':
+	  counters = optarg;
+	  break;
+	case 'J':
+	  jit = false;
+	  break;
+	case 'L':
+	  coded = true;
+	  break;
+	case 'M':
+	  checked = true;
+	  break;
 	case 'm':
 	  mem = strtoul (optarg, NULL, 10);
 	  break;
+	case 'P':
+	  pipe = true;
+	  latency = strtoul (optarg, NULL, 10);
+	  break;
+	case 'p':
+	  protect = true;
+	  break;
 	case 's':
 	  stack = strtoul (optarg, NULL, 10);
 	  break;
+	case 'T':
+	  tags = strtoul (optarg, NULL, 10);
+	  break;
+	case 't':
+	  threaded = true;
+	  break;
+	case 'V':
+	  strict = true;
+	  break;
+	case 'x':
+	  trace.path = optarg;
+	  break;
+	case 'X':
+	  if (yesod_trace_parse (&trace, optarg))
+	    return EXIT_FAILURE;
+	  break;
 	default:
-	  fprintf (stderr, "usage: %s [-m mem] [-s stack] file\n", argv[0]);
+	  fprintf (stderr, "usage: %s [-b budget] [-c blocks] [-D cache] [-F folded] [-I cache] [-j counters] [-J] [-L] [-M] [-m mem] [-P latency] [-p] [-s stack] [-T tag bits] [-t] [-V] [-x trace] [-X every[:lo[:hi]]] file\n", argv[0]);
 	  return EXIT_FAILURE;
 	}
     }
 
   if (optind >= argc)
     {
-      fprintf (stderr, "usage: %s [-m mem] [-s stack] file\n", argv[0]);
+      fprintf (stderr, "usage: %s [-b budget] [-c blocks] [-D cache] [-F folded] [-I cache] [-j counters] [-J] [-L] [-M] [-m mem] [-P latency] [-p] [-s stack] [-T tag bits] [-t] [-V] [-x trace] [-X every[:lo[:hi]]] file\n", argv[0]);
       return EXIT_FAILURE;
     }
 
@@ -46,21 +114,138 @@ main (argc, argv)
     }
 
   if (yesod_init_vm (&vm, mem, stack))
-    return EXIT_FAILURE;
+    {
+      fclose (f);
+      return EXIT_FAILURE;
+    }
+
+  vm.blocks.capacity = blocks;
+  vm.jit.enabled = jit;
+  vm.cfg.strict = strict;
+  vm.memory.protect = protect;
+  vm.tlb.enabled = checked;
+  vm.cons.coded = coded;
+  vm.tags.bits = tags;
+  vm.icache = icache;
+  vm.dcache = dcache;
+  vm.pipe.enabled = pipe;
+  vm.pipe.latency = latency;
+  vm.prof.enabled = !!folded;
+  vm.trace.path = trace.path;
+  vm.trace.every = trace.every;
+  vm.trace.lo = trace.lo;
+  vm.trace.hi = trace.hi;
 
   if (yesod_init_prog (&vm, f))
     {
+      fclose (f);
       yesod_destroy_vm (&vm);
 
       return EXIT_FAILURE;
     }
 
-  while (!(ret = yesod_cycle (&vm)))
-	 ;
+  /* the sections are in memory, mapped over it or copied */
+  fclose (f);
+
+  if (threaded)
+    vm.engine = YESOD_ENGINE_THREADED;
+
+  /* run in slices of `budget` instructions */
+  do
+    stop = yesod_run (&vm, budget);
+  while (stop.reason == YESOD_BUDGET);
 
   yesod_dump_vm (&vm);
 
-  printf ("exit code: %u\n", ret);
+  printf ("stopped: %s at %#010x\n", yesod_stop_name (stop.reason), stop.pc);
+
+  if (stop.reason == YESOD_FAULT)
+    printf ("fault: %s of %#010x\n", yesod_access_name (vm.fault.access),
+	    vm.fault.addr);
+
+  printf ("memory: %u pages of %u bytes resident\n",
+	  yesod_mem_resident (&vm.memory), vm.memory.page);
+
+  if (vm.targets.hits || vm.targets.misses)
+    printf ("targets: %lu hits, %lu misses, returns: %lu hits, %lu misses\n",
+	    (unsigned long)vm.targets.hits, (unsigned long)vm.targets.misses,
+	    (unsigned long)vm.targets.return_hits,
+	    (unsigned long)vm.targets.return_misses);
+
+  if (vm.cons.allocated || vm.cons.collections)
+    printf ("heap: %lu bytes allocated (%.1f MB/s), %lu collections, "
+	    "%.3f ms paused (%.3f ms at most), %.1f%% survived, "
+	    "%lu pages kept\n",
+	    (unsigned long)vm.cons.allocated, yesod_heap_rate (&vm) / 1e6,
+	    (unsigned long)vm.cons.collections, vm.cons.pause / 1e6,
+	    vm.cons.max_pause / 1e6,
+	    vm.cons.scanned ? 100.0 * vm.cons.survived / vm.cons.scanned : 0,
+	    (unsigned long)vm.cons.kept);
+
+  if (vm.cards.marks || vm.cards.scans)
+    printf ("cards: %lu stores marked, %lu scans, %.1f dirty cards per scan "
+	    "(%u at most)\n", (unsigned long)vm.cards.marks,
+	    (unsigned long)vm.cards.scans,
+	    vm.cards.scans ? (double)vm.cards.dirty / vm.cards.scans : 0,
+	    vm.cards.max_dirty);
+
+  if (vm.icache.size)
+    yesod_cache_dump (&vm.icache, "icache");
+
+  if (vm.dcache.size)
+    yesod_cache_dump (&vm.dcache, "dcache");
+
+  if (vm.pipe.instructions)
+    {
+      printf ("pipeline: %lu cycles for %lu instructions, CPI %.3f\n",
+	      (unsigned long)yesod_pipe_cycles (&vm.pipe),
+	      (unsigned long)vm.pipe.instructions,
+	      (double)yesod_pipe_cycles (&vm.pipe) / vm.pipe.instructions);
+
+      for (i = 0; i < YESOD_STALLS; i++)
+	printf ("  %-8s %lu stall cycles\n", yesod_stall_name (i),
+		(unsigned long)vm.pipe.stalls[i]);
+    }
+
+  if (folded)
+    {
+      yesod_prof_dump (&vm);
+
+      f = fopen (folded, "w");
+
+      if (!f || yesod_prof_fold (&vm.prof, f))
+	perror ("yesod");
+
+      if (f)
+	fclose (f);
+    }
+
+  if (counters)
+    {
+      f = fopen (counters, "w");
+
+      if (f)
+	{
+	  yesod_counters_json (&vm, f);
+	  fclose (f);
+	}
+      else
+	perror ("yesod");
+    }
+
+  if (trace.path)
+    {
+      yesod_trace_stop (&vm.trace);
+      printf ("trace: %lu records, %lu stalls on the writer\n",
+	      (unsigned long)vm.trace.records, (unsigned long)vm.trace.stalls);
+    }
+
+  if (vm.tlb.enabled)
+    printf ("tlb: %lu misses\n", (unsigned long)vm.tlb.misses);
+
+  if (vm.jit.native)
+    printf ("jit: %lu instructions run natively in %lu blocks\n",
+	    (unsigned long)vm.jit.native, (unsigned long)vm.jit.compiled);
 
   yesod_destroy_vm (&vm);
 
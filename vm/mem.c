@@ -0,0 +1,111 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <unistd.h>
+#include "mem.h"
+
+/* bytes of guest memory made accessible */
+#define COMMITTED(m) \
+  (((uint64_t)(m)->m_size + (m)->page - 1) & ~(uint64_t)((m)->page - 1))
+
+int
+yesod_mem_init (m, mem, stack)
+     struct yesod_mem	*m;
+     uint32_t		mem;
+     uint32_t		stack;
+{
+  m->m_size = mem;
+  m->s_size = stack;
+  m->page = sysconf (_SC_PAGESIZE);
+  m->mapped = m->resident = 0;
+  m->protect = false;
+  m->guard = 0;
+
+  /* with a page past the end, for accesses that straddle it */
+  m->reserved = YESOD_ADDRESS_SPACE + m->page;
+  m->memory = mmap (NULL, m->reserved, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if (m->memory != MAP_FAILED)
+    {
+      if (!mprotect (m->memory, COMMITTED (m), PROT_READ | PROT_WRITE))
+	return 0;
+
+      munmap (m->memory, m->reserved);
+    }
+
+  m->reserved = COMMITTED (m);
+  m->memory = mmap (NULL, m->reserved, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  return m->memory == MAP_FAILED;
+}
+
+/* sets up the guard pages of protected mode */
+int
+yesod_mem_protect (m)
+     struct yesod_mem *m;
+{
+  /* pushes write a word at `s_size` at most */
+  uint64_t guard = ((uint64_t)m->s_size + 4 + m->page - 1) & ~(uint64_t)(m->page - 1);
+
+  /* past `m_size`, only a reserved address space faults */
+  if (m->reserved == COMMITTED (m) || guard + m->page > YESOD_ADDRESS_SPACE)
+    return 1;
+
+  m->guard = guard;
+
+  return mprotect (m->memory + m->guard, m->page, PROT_NONE);
+}
+
+/*
+ * makes the `size` bytes at `a`, past `m_size`, accessible. returns 1
+ * if they are not reserved, or not whole host pages
+ */
+int
+yesod_mem_open (m, a, size)
+     struct yesod_mem	*m;
+     uint32_t		a;
+     uint32_t		size;
+{
+  if (m->reserved == COMMITTED (m) || a < COMMITTED (m)
+      || (a | size) & (m->page - 1))
+    return 1;
+
+  return mprotect (m->memory + a, size, PROT_READ | PROT_WRITE);
+}
+
+/* pages whose residency `yesod_mem_resident` reads at once */
+#define RESIDENCY (4096)
+
+/*
+ * counts the resident pages of guest memory. pages are never given
+ * back to the host, so the count only grows over a run
+ */
+uint32_t
+yesod_mem_resident (m)
+     struct yesod_mem *m;
+{
+  unsigned char	vec[RESIDENCY];
+  uint64_t	pages = COMMITTED (m) / m->page, i, n, k;
+
+  for (m->resident = 0, i = 0; i < pages; i += n)
+    {
+      n = pages - i < RESIDENCY ? pages - i : RESIDENCY;
+
+      if (mincore (m->memory + i * m->page, n * m->page, vec))
+	break;
+
+      for (k = 0; k < n; k++)
+	m->resident += vec[k] & 1;
+    }
+
+  return m->resident;
+}
+
+void
+yesod_mem_destroy (m)
+     struct yesod_mem *m;
+{
+  munmap (m->memory, m->reserved);
+  m->memory = NULL;
+}
@@ -1,12 +1,52 @@
 #ifndef YESOD_MEM_
 # define YESOD_MEM_
 
+# include <stdbool.h>
+# include <stdint.h>
+
 # define STACK (0x00000000)
 
+/* host address space reserved behind guest memory, when possible */
+# define YESOD_ADDRESS_SPACE ((uint64_t)1 << 32)
+
+/*
+ * first byte past the stack, or past the guard page that follows it
+ * in protected mode
+ */
+# define YESOD_MEM_HEAP(m) ((m)->protect ? (m)->guard + (m)->page : (m)->s_size)
+
+/*
+ * guest memory
+ *
+ * the whole 32-bit address space is reserved up front and only the
+ * first `m_size` bytes, rounded up to a page, are made accessible. the
+ * host commits pages on first touch, so memory costs only what the
+ * program uses. if the reservation fails, only `m_size` bytes are
+ * mapped
+ *
+ * in protected mode, everything past `m_size` up to a page past the
+ * address space, and the page at `guard` right after the stack, cannot
+ * be accessed, and guest accesses to them fault (see fault.h). the
+ * heap then starts after the guard page
+ */
 struct yesod_mem {
   uint32_t	m_size;
   uint32_t	s_size;
   uint8_t	*memory;
+
+  uint32_t	mapped;		/* bytes of the binary mapped, not copied */
+  uint64_t	reserved;	/* bytes of host address space */
+  uint32_t	page;		/* host page size */
+  uint32_t	resident;	/* pages, when last counted */
+
+  bool		protect;
+  uint32_t	guard;
 };
 
+int		yesod_mem_init (struct yesod_mem *, uint32_t, uint32_t);
+int		yesod_mem_protect (struct yesod_mem *);
+int		yesod_mem_open (struct yesod_mem *, uint32_t, uint32_t);
+uint32_t	yesod_mem_resident (struct yesod_mem *);
+void		yesod_mem_destroy (struct yesod_mem *);
+
 #endif /* YESOD_MEM_ */
@@ -0,0 +1,154 @@
+#include "pipe.h"
+#include "vm.h"
+
+void
+yesod_pipe_init (vm)
+     struct yesod_vm *vm;
+{
+  struct yesod_pipe	*p = &vm->pipe;
+  int			i;
+
+  p->loaded = 0;
+  p->flagged = false;
+  p->instructions = 0;
+
+  for (i = 0; i < YESOD_STALLS; i++)
+    p->stalls[i] = 0;
+}
+
+#define BIT(r) ((uint16_t)(1 << (r)))
+
+/* registers `op` reads, along with the flags if `flags` is set */
+static uint16_t
+reads (op, flags)
+     const struct yesod_op	*op;
+     bool			*flags;
+{
+  uint16_t r = 0;
+
+  *flags = op->cond != ALW;
+
+  switch (op->class)
+    {
+    case INSTR_CLASS1:
+      if (op->opcode == NOP || op->opcode == HLT)
+	return 0;
+
+      r = BIT (op->rb);
+
+      if (op->shift != NONE && !(op->bits & OP_SHIFTI))
+	r |= BIT (op->imm);
+
+      /* FALLTHROUGH */
+    case INSTR_CLASS2:
+      if (op->opcode != MOV && op->opcode != CAR && op->opcode != CDR)
+	r |= BIT (op->ra);
+      break;
+    case INSTR_CLASS3:
+      r = BIT (op->ra);
+
+      if (op->shift != NONE && !(op->bits & OP_SHIFTI))
+	r |= BIT (op->imm);
+      break;
+    case INSTR_CLASS4:
+      r = BIT (op->ra);
+      break;
+    }
+
+  if ((op->class == INSTR_CLASS3 || op->class == INSTR_CLASS4)
+      && (op->bits & OP_PUSH))
+    r |= BIT (SP);
+
+  /* x0 always reads 0, or what CMP just left in it */
+  return r & ~BIT (0);
+}
+
+/* true if `op` is a load, which has its result only after memory */
+static bool
+load (op)
+     const struct yesod_op *op;
+{
+  return (op->class == INSTR_CLASS1 || op->class == INSTR_CLASS2)
+    && (op->opcode == CAR || op->opcode == CDR);
+}
+
+/*
+ * times `op`, which just ran if `executed` is set and then jumped if
+ * `taken` is, with `imisses` and `dmisses` cache misses
+ */
+void
+yesod_pipe_retire (vm, op, executed, taken, imisses, dmisses)
+     struct yesod_vm		*vm;
+     const struct yesod_op	*op;
+     bool			executed;
+     bool			taken;
+     uint64_t			imisses;
+     uint64_t			dmisses;
+{
+  struct yesod_pipe	*p = &vm->pipe;
+  uint16_t		r;
+  bool			flags;
+
+  p->instructions++;
+  p->stalls[YESOD_STALL_FETCH] += imisses * p->latency;
+  p->stalls[YESOD_STALL_MEMORY] += dmisses * p->latency;
+
+  r = reads (op, &flags);
+
+  if (r & p->loaded)
+    p->stalls[YESOD_STALL_LOAD]++;
+  else if (flags && p->flagged)
+    p->stalls[YESOD_STALL_FLAGS]++;
+
+  if (taken)
+    p->stalls[YESOD_STALL_BRANCH] += YESOD_PIPE_BRANCH;
+
+  p->loaded = 0;
+  p->flagged = false;
+
+  if (executed && load (op))
+    {
+      p->loaded = BIT (op->ra) & ~BIT (0);
+      p->flagged = true;
+    }
+}
+
+/* cycles of the instructions timed so far */
+uint64_t
+yesod_pipe_cycles (p)
+     const struct yesod_pipe *p;
+{
+  uint64_t	n = p->instructions;
+  int		i;
+
+  if (!n)
+    return 0;
+
+  for (i = 0; i < YESOD_STALLS; i++)
+    n += p->stalls[i];
+
+  return n + YESOD_PIPE_STAGES - 1;
+}
+
+const char *
+yesod_stall_name (cause)
+     enum yesod_stall cause;
+{
+  switch (cause)
+    {
+    case YESOD_STALL_LOAD:
+      return "load-use";
+    case YESOD_STALL_FLAGS:
+      return "flags";
+    case YESOD_STALL_BRANCH:
+      return "branch";
+    case YESOD_STALL_FETCH:
+      return "fetch";
+    case YESOD_STALL_MEMORY:
+      return "memory";
+    case YESOD_STALLS:
+      break;
+    }
+
+  return "unknown";
+}
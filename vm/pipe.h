@@ -0,0 +1,60 @@
+#ifndef YESOD_PIPE_
+# define YESOD_PIPE_
+
+# include <stdbool.h>
+# include <stdint.h>
+# include "decoder.h"
+
+struct yesod_vm;
+
+/* stages of the pipeline, fetch, decode, execute, memory and writeback */
+# define YESOD_PIPE_STAGES (5)
+
+/* cycles lost on a taken jump, resolved in execute */
+# ifndef YESOD_PIPE_BRANCH
+#  define YESOD_PIPE_BRANCH (2)
+# endif
+
+/* causes of stalls */
+enum yesod_stall {
+  YESOD_STALL_LOAD,		/* register loaded by the previous instruction */
+  YESOD_STALL_FLAGS,		/* flags set by a load, tested right after */
+  YESOD_STALL_BRANCH,		/* taken jump */
+  YESOD_STALL_FETCH,		/* I-cache miss */
+  YESOD_STALL_MEMORY,		/* D-cache miss */
+  YESOD_STALLS
+};
+
+/*
+ * timing model of a classic in-order pipeline
+ *
+ * every instruction retired by the switch engine goes through the five
+ * stages in a cycle each, results being forwarded from execute and
+ * memory. an instruction thus only waits when it needs a register, or
+ * the flags, that the load before it (CAR, CDR) only has after memory.
+ * jumps are predicted not taken, and taken ones flush the two younger
+ * stages. instructions whose condition does not hold still go through,
+ * without writing anything
+ *
+ * memory answers in a cycle, unless the caches are modelled (see
+ * cache.h), in which case each miss stalls the pipeline for `latency`
+ * cycles. services (see service.h), and instructions that trap, are not
+ * timed
+ */
+struct yesod_pipe {
+  bool		enabled;
+  uint32_t	latency;
+
+  uint16_t	loaded;		/* registers the last instruction loaded */
+  bool		flagged;	/* and whether it set the flags */
+
+  uint64_t	instructions;
+  uint64_t	stalls[YESOD_STALLS];
+};
+
+void		yesod_pipe_init (struct yesod_vm *);
+void		yesod_pipe_retire (struct yesod_vm *, const struct yesod_op *, bool, bool, uint64_t, uint64_t);
+uint64_t	yesod_pipe_cycles (const struct yesod_pipe *);
+const char	*yesod_stall_name (enum yesod_stall);
+
+#endif /* YESOD_PIPE_ */
@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include "predecode.h"
+#include "vm.h"
+
+int
+yesod_predecode_init (vm)
+     struct yesod_vm *vm;
+{
+  uint32_t size = (vm->memory.m_size - vm->text) & ~(uint32_t)3;
+
+  vm->decoded.base = vm->text;
+  vm->decoded.size = 0;
+  vm->decoded.ops = calloc (size / 4 + 1, sizeof (struct yesod_op));
+
+  if (!vm->decoded.ops)
+    return 1;
+
+  vm->decoded.size = size;
+
+  return 0;
+}
+
+/*
+ * returns the slot for the word at `pc`, decoding it if needed
+ *
+ * `pc` must be a word-aligned address within the predecoded region
+ */
+const struct yesod_op *
+yesod_predecode_fill (vm, pc)
+     struct yesod_vm	*vm;
+     uint32_t		pc;
+{
+  struct yesod_op	*op = &vm->decoded.ops[(pc - vm->decoded.base) >> 2];
+  uint8_t		*m = vm->memory.memory + pc;
+
+  if (!(op->bits & OP_VALID))
+    *op = yesod_predecode ((uint32_t)m[0]
+			   | ((uint32_t)m[1] << 8)
+			   | ((uint32_t)m[2] << 16)
+			   | ((uint32_t)m[3] << 24));
+
+  return op;
+}
+
+/*
+ * drops the slots overlapping the `len` bytes written at `a`, and the
+ * marks of the control-flow graph with them (see verify.h)
+ */
+void
+yesod_predecode_invalidate (vm, a, len)
+     struct yesod_vm	*vm;
+     uint32_t		a;
+     uint32_t		len;
+{
+  uint64_t lo = a, hi = (uint64_t)a + len;
+  uint64_t base = vm->decoded.base, end = base + vm->decoded.size;
+
+  if (lo < base)
+    lo = base;
+  if (hi > end)
+    hi = end;
+
+  if (lo < hi)
+    vm->cfg.stale = true;
+
+  for (lo = base + ((lo - base) & ~(uint64_t)3); lo < hi; lo += 4)
+    vm->decoded.ops[(lo - base) >> 2].bits = 0;
+}
+
+void
+yesod_predecode_destroy (vm)
+     struct yesod_vm *vm;
+{
+  free (vm->decoded.ops);
+
+  vm->decoded.ops = NULL;
+  vm->decoded.size = 0;
+}
@@ -0,0 +1,30 @@
+#ifndef YESOD_PREDECODE_
+# define YESOD_PREDECODE_
+
+# include <stdint.h>
+# include "decoder.h"
+
+struct yesod_vm;
+
+/*
+ * predecoded instruction cache
+ *
+ * one slot per word of .text, filled lazily the first time the word is
+ * executed and invalidated when the word is written to
+ */
+struct yesod_predecode {
+  uint32_t		base;
+  uint32_t		size;	/* in bytes, a multiple of 4 */
+  struct yesod_op	*ops;
+};
+
+/* true if `a` falls within the predecoded region */
+# define YESOD_PREDECODED(vm, a) \
+  ((uint32_t)((a) - (vm)->decoded.base) < (vm)->decoded.size)
+
+int			yesod_predecode_init (struct yesod_vm *);
+const struct yesod_op	*yesod_predecode_fill (struct yesod_vm *, uint32_t);
+void			yesod_predecode_invalidate (struct yesod_vm *, uint32_t, uint32_t);
+void			yesod_predecode_destroy (struct yesod_vm *);
+
+#endif /* YESOD_PREDECODE_ */
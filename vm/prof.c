@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <string.h>
+#include "prof.h"
+#include "service.h"
+#include "vm.h"
+
+/* sets the profiler up once the program is loaded, returns 1 on error */
+int
+yesod_prof_init (vm)
+     struct yesod_vm *vm;
+{
+  struct yesod_prof *p = &vm->prof;
+
+  memset (p->retired, 0, sizeof (p->retired));
+  memset (p->skipped, 0, sizeof (p->skipped));
+  p->pcs = NULL;
+  p->frames = NULL;
+  p->nframes = p->current = p->depth = 0;
+
+  if (!p->enabled)
+    return 0;
+
+  p->base = vm->decoded.base;
+  p->words = vm->decoded.size / 4;
+  p->pcs = calloc (p->words + 1, sizeof (*p->pcs));
+  p->frames = malloc (YESOD_PROF_FRAMES * sizeof (*p->frames));
+
+  if (!p->pcs || !p->frames)
+    {
+      fprintf (stderr, "yesod: could not allocate the profiler\n");
+      return 1;
+    }
+
+  /* the entry point */
+  p->frames[0].pc = vm->text;
+  p->frames[0].parent = 0;
+  p->frames[0].child = p->frames[0].sibling = 0;
+  p->frames[0].self = 0;
+  p->nframes = 1;
+
+  return 0;
+}
+
+/* enters the function at `pc` from the current frame */
+static void
+call (p, pc)
+     struct yesod_prof	*p;
+     uint32_t		pc;
+{
+  struct yesod_frame	*f = &p->frames[p->current];
+  uint32_t		i;
+
+  if (p->depth)
+    {
+      p->depth++;
+      return;
+    }
+
+  for (i = f->child; i; i = p->frames[i].sibling)
+    if (p->frames[i].pc == pc)
+      {
+	p->current = i;
+	return;
+      }
+
+  if (p->nframes == YESOD_PROF_FRAMES)
+    {
+      p->depth++;
+      return;
+    }
+
+  i = p->nframes++;
+  p->frames[i].pc = pc;
+  p->frames[i].parent = p->current;
+  p->frames[i].child = 0;
+  p->frames[i].sibling = f->child;
+  p->frames[i].self = 0;
+  f->child = i;
+  p->current = i;
+}
+
+/*
+ * counts `op`, the instruction at `pc`, which ran if `executed` is
+ * set, x14 then holding the next pc
+ */
+void
+yesod_prof_retire (vm, op, pc, executed)
+     struct yesod_vm		*vm;
+     const struct yesod_op	*op;
+     uint32_t			pc;
+     bool			executed;
+{
+  struct yesod_prof	*p = &vm->prof;
+  uint32_t		next = vm->regs[PC];
+
+  if ((pc - p->base) / 4 < p->words)
+    p->pcs[(pc - p->base) / 4]++;
+  else
+    p->pcs[p->words]++;
+
+  if (!executed)
+    {
+      p->skipped[op->class][op->opcode & 0xF]++;
+      return;
+    }
+
+  p->retired[op->class][op->opcode & 0xF]++;
+  p->frames[p->current].self++;
+
+  if (op->class != INSTR_CLASS3 && op->class != INSTR_CLASS4)
+    return;
+
+  /* services return by themselves, see service.h */
+  if (op->bits & OP_PUSH)
+    {
+      if (!YESOD_SERVICE (vm, next))
+	call (p, next);
+    }
+  else if (op->class == INSTR_CLASS3 && op->opcode == JA)
+    {
+      if (p->depth)
+	p->depth--;
+      else
+	p->current = p->frames[p->current].parent;
+    }
+}
+
+/* writes the frames as folded stacks, returns 1 on error */
+int
+yesod_prof_fold (p, f)
+     const struct yesod_prof	*p;
+     FILE			*f;
+{
+  uint32_t	*path, i, j, n;
+
+  path = malloc (p->nframes * sizeof (*path));
+
+  if (!path)
+    return 1;
+
+  for (i = 0; i < p->nframes; i++)
+    {
+      if (!p->frames[i].self)
+	continue;
+
+      for (n = 0, j = i; j; j = p->frames[j].parent)
+	path[n++] = j;
+
+      fprintf (f, "%#010x", p->frames[0].pc);
+
+      while (n--)
+	fprintf (f, ";%#010x", p->frames[path[n]].pc);
+
+      fprintf (f, " %lu\n", (unsigned long)p->frames[i].self);
+    }
+
+  free (path);
+
+  return ferror (f) ? 1 : 0;
+}
+
+/* prints the counts by opcode and the hottest blocks */
+void
+yesod_prof_dump (vm)
+     struct yesod_vm *vm;
+{
+  struct yesod_prof	*p = &vm->prof;
+  uint32_t		hot[YESOD_PROF_HOT], n, i, j;
+  uint64_t		total = 0, all = 0, *sums;
+  int			c, o;
+
+  for (c = 0; c < 4; c++)
+    for (o = 0; o < 16; o++)
+      total += p->retired[c][o];
+
+  printf ("profile: %lu instructions retired\n", (unsigned long)total);
+
+  for (c = 0; c < 4; c++)
+    for (o = 0; o < 16; o++)
+      if (p->retired[c][o] || p->skipped[c][o])
+	printf ("  %-4s %-3s %12lu retired %12lu skipped\n",
+		c == 0 ? "I" : c == 1 ? "II" : c == 2 ? "III" : "IV",
+		yesod_opcode_name (o), (unsigned long)p->retired[c][o],
+		(unsigned long)p->skipped[c][o]);
+
+  /* instructions run in each block, on its leader */
+  yesod_cfg_refresh (vm);
+  sums = calloc (p->words + 1, sizeof (*sums));
+
+  if (!sums || !vm->cfg.marks)
+    {
+      free (sums);
+      return;
+    }
+
+  for (i = 0, j = 0; i < p->words; i++)
+    {
+      if (vm->cfg.marks[i] & CFG_LEADER)
+	j = i;
+
+      sums[j] += p->pcs[i];
+      all += p->pcs[i];
+    }
+
+  n = yesod_counters_top (sums, p->words, hot, YESOD_PROF_HOT);
+
+  printf ("hot blocks, by instructions run or skipped:\n");
+
+  for (i = 0; i < n; i++)
+    printf ("  %#010x %12lu entries %12lu instructions (%.1f%%)\n",
+	    p->base + 4 * hot[i], (unsigned long)p->pcs[hot[i]],
+	    (unsigned long)sums[hot[i]], 100.0 * sums[hot[i]] / all);
+
+  free (sums);
+}
+
+void
+yesod_prof_destroy (p)
+     struct yesod_prof *p;
+{
+  free (p->pcs);
+  free (p->frames);
+  p->pcs = NULL;
+  p->frames = NULL;
+}
@@ -0,0 +1,74 @@
+#ifndef YESOD_PROF_
+# define YESOD_PROF_
+
+# include <stdbool.h>
+# include <stdint.h>
+# include <stdio.h>
+# include "decoder.h"
+
+struct yesod_vm;
+
+/* most frames of the calling-context tree */
+# ifndef YESOD_PROF_FRAMES
+#  define YESOD_PROF_FRAMES (1 << 16)
+# endif
+
+/* blocks of the hot-block report */
+# ifndef YESOD_PROF_HOT
+#  define YESOD_PROF_HOT (10)
+# endif
+
+/*
+ * frame of the calling-context tree: the function entered at `pc`
+ * from the frame `parent`, along with the instructions run in it
+ */
+struct yesod_frame {
+  uint32_t	pc;
+  uint32_t	parent;
+  uint32_t	child;		/* first callee */
+  uint32_t	sibling;	/* next callee of the parent */
+  uint64_t	self;
+};
+
+/*
+ * execution profiler
+ *
+ * counts the instructions the switch engine retires, by class and
+ * opcode, and the conditional ones it skips, by the same, but not the
+ * ones that trap (see counters.h). every word of .text
+ * has its own count, of the times it ran or was skipped, from which
+ * the hot-block report sums the blocks of the control-flow graph (see
+ * verify.h)
+ *
+ * calls are tracked as in target.h: a jump with push that is taken
+ * enters the frame of its target, under the current one, and a class
+ * III JA without push returns to the frame above. frames form a tree
+ * rooted at the entry point, whose paths are written as folded stacks,
+ * `0x1000;0x1040;0x10c8 123` being 123 instructions run in the
+ * function at 0x10c8, called from the one at 0x1040, itself called
+ * from the entry point. once YESOD_PROF_FRAMES frames are in use, new
+ * calls are charged to their caller
+ */
+struct yesod_prof {
+  bool			enabled;
+
+  uint64_t		retired[4][16];	/* by class and opcode */
+  uint64_t		skipped[4][16];
+
+  uint32_t		base;		/* .text */
+  uint32_t		words;
+  uint64_t		*pcs;
+
+  struct yesod_frame	*frames;
+  uint32_t		nframes;
+  uint32_t		current;
+  uint32_t		depth;		/* of calls charged to `current` */
+};
+
+int	yesod_prof_init (struct yesod_vm *);
+void	yesod_prof_retire (struct yesod_vm *, const struct yesod_op *, uint32_t, bool);
+int	yesod_prof_fold (const struct yesod_prof *, FILE *);
+void	yesod_prof_dump (struct yesod_vm *);
+void	yesod_prof_destroy (struct yesod_prof *);
+
+#endif /* YESOD_PROF_ */
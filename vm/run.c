@@ -0,0 +1,152 @@
+#define _GNU_SOURCE
+#include <setjmp.h>
+#include "run.h"
+
+static struct yesod_stop
+run_switch (vm, budget)
+     struct yesod_vm	*vm;
+     uint64_t		budget;
+{
+  struct yesod_stop	stop;
+  uint32_t		ret;
+  const bool		protect = vm->memory.protect;
+
+  for (stop.executed = 0; stop.executed < budget; )
+    {
+      stop.pc = vm->regs[PC];
+
+      /* where a fault leaves from, see fault.h */
+      if (protect)
+	{
+	  vm->fault.from = stop.pc;
+	  vm->fault.executed = stop.executed;
+	}
+
+      ret = yesod_cycle (vm);
+
+      /* HLT retires, an instruction that traps does not */
+      if (!ret || ret == YESOD_HALT)
+	{
+	  stop.executed++;
+	  vm->counters.retired++;
+	}
+
+      if (ret)
+	{
+	  stop.reason = ret;
+
+	  return stop;
+	}
+    }
+
+  stop.reason = YESOD_BUDGET;
+  stop.pc = vm->regs[PC];
+
+  return stop;
+}
+
+/*
+ * cache models, the timing model, the profiler and the tracer only see
+ * the instructions of the switch engine, see cache.h, pipe.h, prof.h
+ * and trace.h
+ */
+static struct yesod_stop
+run_engine (vm, budget)
+     struct yesod_vm	*vm;
+     uint64_t		budget;
+{
+  struct yesod_stop stop;
+
+  if (vm->icache.size || vm->dcache.size || vm->pipe.enabled
+      || vm->prof.enabled || vm->trace.path)
+    stop = run_switch (vm, budget);
+  else
+    switch (vm->engine)
+      {
+      case YESOD_ENGINE_THREADED:
+#ifdef __GNUC__
+	stop = yesod_run_threaded (vm, budget);
+	break;
+#endif
+      case YESOD_ENGINE_SWITCH:
+      default:
+	stop = run_switch (vm, budget);
+	break;
+      }
+
+  /* an instruction that traps runs again if the VM resumes */
+  if (stop.reason != YESOD_HALT && stop.reason != YESOD_BUDGET)
+    vm->regs[PC] = stop.pc;
+
+  return stop;
+}
+
+/*
+ * executes at most `budget` instructions with the VM's engine, or
+ * until the program stops. in protected mode, the engine is left for
+ * here on a guest memory fault, see fault.h
+ */
+struct yesod_stop
+yesod_run (vm, budget)
+     struct yesod_vm	*vm;
+     uint64_t		budget;
+{
+  sigjmp_buf		env;
+  struct yesod_stop	stop;
+  const uint64_t	retired = vm->counters.retired;
+
+  if (!vm->memory.protect)
+    {
+      stop = run_engine (vm, budget);
+      yesod_counters_sync (vm);
+
+      return stop;
+    }
+
+  if (sigsetjmp (env, 1))
+    {
+      yesod_fault_disarm ();
+      yesod_fault_resolve (vm);
+
+      /* the faulting instruction runs again if the VM resumes */
+      stop.reason = YESOD_FAULT;
+      stop.pc = vm->regs[PC] = vm->fault.pc;
+      stop.executed = vm->fault.executed;
+      vm->counters.retired = retired + stop.executed;
+      yesod_counters_sync (vm);
+
+      return stop;
+    }
+
+  yesod_fault_arm (vm, &env);
+  stop = run_engine (vm, budget);
+  yesod_fault_disarm ();
+  yesod_counters_sync (vm);
+
+  return stop;
+}
+
+const char *
+yesod_stop_name (reason)
+     enum yesod_stop_reason reason;
+{
+  switch (reason)
+    {
+    case YESOD_RUNNING:
+      return "running";
+    case YESOD_HALT:
+      return "halt";
+    case YESOD_BUDGET:
+      return "budget exhausted";
+    case YESOD_INVALID:
+      return "invalid instruction";
+    case YESOD_STACK_OVERFLOW:
+      return "stack overflow";
+    case YESOD_FAULT:
+      return "memory fault";
+    case YESOD_TYPE:
+      return "type trap";
+    }
+
+  return "unknown";
+}
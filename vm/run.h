@@ -0,0 +1,34 @@
+#ifndef YESOD_RUN_
+# define YESOD_RUN_
+
+# include <stdint.h>
+# include "cycle.h"
+
+/* no instruction budget */
+# define YESOD_UNLIMITED (~(uint64_t)0)
+
+/*
+ * outcome of a call to `yesod_run`
+ *
+ * `pc` is the address of the instruction that stopped the VM, or, if
+ * the budget ran out, that of the next instruction to execute.
+ * `executed` counts HLT, but not an instruction that traps, which is
+ * not retired either (see counters.h). calling `yesod_run` again
+ * resumes at `vm->regs[PC]`: past HLT, at the next instruction once the
+ * budget ran out, and otherwise at `pc`, to run the instruction that
+ * trapped again
+ */
+struct yesod_stop {
+  enum yesod_stop_reason	reason;
+  uint32_t			pc;
+  uint64_t			executed;
+};
+
+struct yesod_stop	yesod_run (struct yesod_vm *, uint64_t);
+const char		*yesod_stop_name (enum yesod_stop_reason);
+
+# ifdef __GNUC__
+struct yesod_stop	yesod_run_threaded (struct yesod_vm *, uint64_t);
+# endif
+
+#endif /* YESOD_RUN_ */
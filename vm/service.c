@@ -0,0 +1,48 @@
+#include "cards.h"
+#include "cycle.h"
+#include "heap.h"
+#include "service.h"
+
+/* runs the service at `pc`, returns 0 or why the VM stopped */
+uint32_t
+yesod_service (vm, pc)
+     struct yesod_vm	*vm;
+     uint32_t		pc;
+{
+  uint32_t sp = vm->regs[SP];
+
+  /* the return address the call pushed */
+  if (sp - STACK < 4 || sp - STACK > vm->memory.s_size + 4 || pc & 3)
+    return YESOD_INVALID;
+
+  switch ((pc - YESOD_SERVICES) / 4)
+    {
+    case YESOD_SERVICE_CONS:
+      vm->regs[1] = yesod_heap_cons (vm, vm->regs[1], vm->regs[2]);
+      break;
+    case YESOD_SERVICE_GC:
+      yesod_heap_collect (vm);
+      break;
+    case YESOD_SERVICE_LIST:
+      vm->regs[1] = yesod_heap_list (vm, vm->regs[1], vm->regs[2]);
+      break;
+    case YESOD_SERVICE_CARDS:
+      vm->regs[1] = yesod_cards_set (vm, vm->regs[1], vm->regs[2],
+				     vm->regs[3]);
+      break;
+    case YESOD_SERVICE_SCAN:
+      vm->regs[1] = yesod_cards_scan (vm);
+      break;
+    case YESOD_SERVICE_COUNTERS:
+      yesod_counters_sync (vm);
+      break;
+    default:
+      return YESOD_INVALID;
+    }
+
+  vm->regs[SP] = sp -= 4;
+  vm->regs[PC] = YESOD_LE32 (vm->memory.memory + sp);
+  yesod_return_drop (vm);
+
+  return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef YESOD_SERVICE_
+# define YESOD_SERVICE_
+
+# include <stdint.h>
+
+struct yesod_vm;
+
+/*
+ * service page
+ *
+ * the last page of the address space is not memory. jumping with push
+ * to its `n`th word runs host service `n` instead, which then returns
+ * to the address the jump pushed, popping it. arguments are passed in
+ * x1 to x3, and the result in x1:
+ *
+ * 0 CONS - x1 gets a new cons cell of car x1 and cdr x2, or 0 if the
+ *          heap is full (see heap.h)
+ * 1 GC   - collects the heap
+ * 2 LIST - x1 gets a new list of the x2 words at x1, CDR-coded if the
+ *          heap is, or 0 if the heap is full or x2 is 0
+ * 3 CARDS - marks the cards of the x2 bytes at x1 in the table at x3,
+ *          see cards.h, or stops marking if x2 is 0. x1 gets the
+ *          number of cards, or 0 if the table does not fit
+ * 4 SCAN - x1 gets the number of dirty cards
+ * 5 COUNTERS - writes the counters to their page, see counters.h
+ *
+ * the page is only there as long as memory does not reach it
+ */
+# define YESOD_SERVICES (0xFFFFF000)
+
+enum yesod_service {
+  YESOD_SERVICE_CONS,
+  YESOD_SERVICE_GC,
+  YESOD_SERVICE_LIST,
+  YESOD_SERVICE_CARDS,
+  YESOD_SERVICE_SCAN,
+  YESOD_SERVICE_COUNTERS
+};
+
+/* true if `pc` is in the service page */
+# define YESOD_SERVICE(vm, pc)						\
+  ((pc) >= YESOD_SERVICES && (vm)->memory.m_size <= YESOD_SERVICES)
+
+uint32_t yesod_service (struct yesod_vm *, uint32_t);
+
+#endif /* YESOD_SERVICE_ */
@@ -0,0 +1,40 @@
+#ifndef YESOD_TAGS_
+# define YESOD_TAGS_
+
+# include <stdint.h>
+
+/* most tag bits, so that cells (see heap.h) are still tagged cons */
+# define YESOD_TAG_BITS (3)
+
+/* tag of cons cells */
+# define YESOD_TAG_CONS (0)
+
+/*
+ * tagged words
+ *
+ * in tagged mode, the low `bits` bits of every word are its type tag,
+ * and cons cells are the words tagged YESOD_TAG_CONS. CAR and CDR of
+ * any other word stop the VM with a type trap, and the TAG condition
+ * holds if the operands of the last CMP had the same tag, so that
+ *
+ *	CMP	x1, FIXNUM
+ *	JR.TAG	fixnum
+ *
+ * branches on the type of x1 without touching the flags
+ *
+ * CMP always records the xor of its operands in `last`. out of tagged
+ * mode `mask` is 0, so TAG always holds and no word traps
+ */
+struct yesod_tags {
+  uint8_t	bits;
+  uint32_t	mask;
+  uint32_t	last;
+};
+
+/* true if the TAG condition holds */
+# define YESOD_TAG_MATCH(t) (!((t)->last & (t)->mask))
+
+/* true if CAR or CDR of `x` traps */
+# define YESOD_TAG_TRAP(t, x) (((x) & (t)->mask) != YESOD_TAG_CONS)
+
+#endif /* YESOD_TAGS_ */
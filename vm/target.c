@@ -0,0 +1,137 @@
+#include <string.h>
+#include "target.h"
+#include "vm.h"
+
+void
+yesod_targets_init (vm)
+     struct yesod_vm *vm;
+{
+  memset (&vm->targets, 0, sizeof (vm->targets));
+}
+
+/* records `pc` as the address the next return should land on */
+void
+yesod_return_push (vm, pc, caller)
+     struct yesod_vm	*vm;
+     uint32_t		pc;
+     struct yesod_block	*caller;
+{
+  struct yesod_targets	*t = &vm->targets;
+  struct yesod_return	*r = &t->returns[t->top++ & (YESOD_RETURNS - 1)];
+
+  r->pc = pc;
+  r->caller = caller;
+  r->id = caller ? caller->id : 0;
+
+  if (t->depth < YESOD_RETURNS)
+    t->depth++;
+}
+
+/* drops the return address on top of the shadow stack */
+void
+yesod_return_drop (vm)
+     struct yesod_vm *vm;
+{
+  struct yesod_targets *t = &vm->targets;
+
+  if (t->depth)
+    {
+      t->depth--;
+      t->top--;
+    }
+}
+
+/* the return address on top of the shadow stack, if it is `pc` */
+static struct yesod_block *
+predict_return (vm, pc)
+     struct yesod_vm	*vm;
+     uint32_t		pc;
+{
+  struct yesod_targets	*t = &vm->targets;
+  struct yesod_return	*r;
+  struct yesod_block	*b, *caller;
+  uint32_t		id;
+
+  if (!t->depth)
+    return NULL;
+
+  t->depth--;
+  r = &t->returns[--t->top & (YESOD_RETURNS - 1)];
+
+  if (r->pc != pc)
+    return NULL;
+
+  caller = r->caller;
+  id = r->id;
+
+  if (!id || caller->id != id)
+    return yesod_block_lookup (vm, pc);
+
+  if (YESOD_CHAINED (caller->next[0], pc))
+    return caller->next[0].block;
+
+  /* the lookup may evict the caller, which is then not chained */
+  b = yesod_block_lookup (vm, pc);
+
+  if (caller->id == id && b->id)
+    {
+      caller->next[0].pc = pc;
+      caller->next[0].id = b->id;
+      caller->next[0].block = b;
+    }
+
+  return b;
+}
+
+#define HASH(src) (((src) >> 2) & (YESOD_TARGETS - 1))
+
+/*
+ * returns the block an indirect jump from `src` landed on at `pc`,
+ * `ret` being true if the jump is a return
+ */
+struct yesod_block *
+yesod_target_lookup (vm, src, pc, ret)
+     struct yesod_vm	*vm;
+     uint32_t		src;
+     uint32_t		pc;
+     bool		ret;
+{
+  struct yesod_targets	*t = &vm->targets;
+  struct yesod_target	*e;
+  struct yesod_block	*b;
+
+  if (ret)
+    {
+      b = predict_return (vm, pc);
+
+      if (b)
+	{
+	  t->return_hits++;
+	  return b;
+	}
+
+      t->return_misses++;
+    }
+
+  /* the entry of `src` holds its last target, which `pc` must be */
+  e = &t->cache[HASH (src)];
+
+  if (e->src == src && YESOD_CHAINED (e->link, pc))
+    {
+      t->hits++;
+      return e->link.block;
+    }
+
+  t->misses++;
+  b = yesod_block_lookup (vm, pc);
+
+  if (b->id)
+    {
+      e->src = src;
+      e->link.pc = pc;
+      e->link.id = b->id;
+      e->link.block = b;
+    }
+
+  return b;
+}
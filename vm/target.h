@@ -0,0 +1,63 @@
+#ifndef YESOD_TARGET_
+# define YESOD_TARGET_
+
+# include <stdbool.h>
+# include <stdint.h>
+# include "block.h"
+
+struct yesod_vm;
+
+/* entries of the indirect-target cache, a power of 2 */
+# ifndef YESOD_TARGETS
+#  define YESOD_TARGETS (256)
+# endif
+
+/* depth of the shadow return stack, a power of 2 */
+# ifndef YESOD_RETURNS
+#  define YESOD_RETURNS (64)
+# endif
+
+/* block last reached from the indirect jump at `src` */
+struct yesod_target {
+  uint32_t		src;
+  struct yesod_link	link;
+};
+
+/*
+ * return address pushed by a jump, `caller` being the block the jump
+ * ended, whose fallthrough link leads to the return address
+ */
+struct yesod_return {
+  uint32_t		pc;
+  uint32_t		id;
+  struct yesod_block	*caller;
+};
+
+/*
+ * prediction of the indirect jumps (class III)
+ *
+ * returns are class III JAs without push, and are first matched
+ * against the top of a shadow of the pushed return addresses, which
+ * wraps around once full. other indirect jumps, and returns it does
+ * not predict, go through a direct-mapped cache keyed by the source
+ * pc, holding the last target of each jump, before the global block
+ * lookup. only the threaded engine predicts
+ */
+struct yesod_targets {
+  struct yesod_target	cache[YESOD_TARGETS];
+  struct yesod_return	returns[YESOD_RETURNS];
+  uint32_t		top;
+  uint32_t		depth;
+
+  uint64_t		hits;
+  uint64_t		misses;
+  uint64_t		return_hits;
+  uint64_t		return_misses;
+};
+
+void			yesod_targets_init (struct yesod_vm *);
+void			yesod_return_push (struct yesod_vm *, uint32_t, struct yesod_block *);
+void			yesod_return_drop (struct yesod_vm *);
+struct yesod_block	*yesod_target_lookup (struct yesod_vm *, uint32_t, uint32_t, bool);
+
+#endif /* YESOD_TARGET_ */
@@ -0,0 +1,648 @@
+#include "decoder.h"
+#include "handler.h"
+#include "run.h"
+
+#ifdef __GNUC__
+
+/*
+ * threaded execution engine
+ *
+ * runs the same instruction set as yesod_cycle, but stays within a
+ * single function until the program stops or the budget runs out.
+ * instructions are run from translated blocks (see block.h), and
+ * blocks are chained to their successors as they are first reached.
+ * every instruction has a handler specialized for its opcode, shift,
+ * size and condition (see handler.h), and each handler jumps straight
+ * to the next one through a table of label addresses (GCC
+ * labels-as-values). common pairs of instructions run through a
+ * single fused handler. the budget is charged a whole block at a
+ * time. flags are evaluated lazily (see flags.h), and only worked out
+ * for conditions that test them
+ */
+
+/*
+ * condition `c` holds if the flag `cond_flag[c]` is set exactly when
+ * `cond_set[c]` is. TAG tests no flag, see tags.h
+ */
+static const uint8_t cond_flag[8] = {
+  0, FLAG_NIL, FLAG_CARRY, FLAG_CARRY, FLAG_NIL, 0, FLAG_OVER, FLAG_OVER
+};
+static const uint8_t cond_set[8] = {
+  0, 1, 1, 0, 0, 0, 0, 1
+};
+
+#define CHECK(c)							\
+  ((c) == TAG ? YESOD_TAG_MATCH (&vm->tags)				\
+   : !!(flags & cond_flag[c]) == cond_set[c])
+
+/* jumps to the handler of `op`, the instruction at `pc` */
+#define DISPATCH()							\
+  do									\
+    {									\
+      /* reset x0 to 0 before every cycle */				\
+      r[0] = 0;								\
+      r[PC] = pc + 4;							\
+									\
+      goto *handlers[op->handler];					\
+    }									\
+  while (0)
+
+/* moves on to the next instruction of the block, if any */
+#define NEXT								\
+  do									\
+    {									\
+      if (++op == end)							\
+	goto chain;							\
+									\
+      pc += 4;								\
+      DISPATCH ();							\
+    }									\
+  while (0)
+
+/* skips the instruction if it has a condition that does not hold */
+#define COND(cc)				\
+  do						\
+    {						\
+      if (cc)					\
+	{					\
+	  flags = LAZY_FOLD (flags, lazy);	\
+	  if (!CHECK (op->cond))		\
+	    NEXT;				\
+	}					\
+    }						\
+  while (0)
+
+/* shift count of classes I and III */
+#define COUNT ((op->bits & OP_SHIFTI) ? op->imm : (uint8_t)r[op->imm])
+
+#define FLAGSET(x) LAZY_RESULT (lazy, x)
+
+/*
+ * in protected mode, a guest access can leave the engine for good
+ * (see fault.h), so the flags and counters kept in locals are written
+ * back before it. RUN notes the start of a straight run of instructions, `n` of
+ * them having run before it
+ */
+#define SPILL()								\
+  do									\
+    {									\
+      if (protect)							\
+	{								\
+	  vm->flags = flags;						\
+	  vm->lazy = lazy;						\
+	  SYNC_COUNTERS ();						\
+	}								\
+    }									\
+  while (0)
+
+#define RUN(a, n)							\
+  do									\
+    {									\
+      if (protect)							\
+	{								\
+	  vm->fault.from = (a);						\
+	  vm->fault.executed = (n);					\
+	}								\
+    }									\
+  while (0)
+
+/* loads the `len` bytes at `a` into `rd` */
+#define LOAD(rd, a, len)					\
+  do								\
+    {								\
+      uint32_t x;						\
+								\
+      if (!tlb)							\
+	{							\
+	  const uint8_t *p = m + (a);				\
+								\
+	  SPILL ();						\
+	  x = YESOD_LE (p, (len));				\
+	}							\
+      else if (YESOD_LOAD (vm, (a), (len), x))			\
+	goto fault;						\
+								\
+      reads++;							\
+								\
+      r[rd] = x;						\
+      FLAGSET (x);						\
+    }								\
+  while (0)
+
+/*
+ * stores the `len` low bytes of `x` at `a`, marking its card (see
+ * cards.h). a store into .text drops every translated block, including
+ * the one running, which is left straight away
+ */
+#define STORE(a, x, len)						\
+  do									\
+    {									\
+      const uint32_t n = (len);						\
+									\
+      if (!tlb)								\
+	{								\
+	  uint8_t *p = m + (a);						\
+									\
+	  SPILL ();							\
+	  YESOD_SET_LE (p, n, (x));					\
+	}								\
+      else if (YESOD_STORE (vm, (a), n, (x)))				\
+	goto fault;							\
+									\
+      YESOD_COUNT_HEAP (vm, (a), (a) + n);				\
+      writes++;								\
+									\
+      if (YESOD_CARD (vm, (a)))						\
+	YESOD_CARD_MARK (vm, (a));					\
+									\
+      if ((uint32_t)((a) - base) < size					\
+	  || (uint32_t)((a) + n - 1 - base) < size)			\
+	{								\
+	  yesod_predecode_invalidate (vm, (a), n);			\
+	  yesod_blocks_flush (vm);					\
+	  goto flushed;							\
+	}								\
+    }									\
+  while (0)
+
+/*
+ * the counters this engine keeps in locals (see counters.h), until
+ * they are folded into the VM's
+ */
+#define SYNC_COUNTERS()							\
+  do									\
+    {									\
+      vm->counters.retired = retired + (budget - left);		\
+      vm->counters.taken += taken;					\
+      vm->counters.not_taken += not_taken;				\
+      vm->counters.pushes += pushes;					\
+      vm->counters.reads += reads;					\
+      vm->counters.writes += writes;					\
+      YESOD_COUNT_SP (vm, top);						\
+      taken = not_taken = pushes = reads = writes = 0;			\
+    }									\
+  while (0)
+
+#define PUSH(p)								\
+  do									\
+    {									\
+      if (p)								\
+	{								\
+	  uint32_t sp = r[SP], x = r[PC];				\
+									\
+	  if (sp - STACK > vm->memory.s_size)				\
+	    goto stack_overflow;					\
+									\
+	  if (tlb)							\
+	    {								\
+	      if (YESOD_STORE (vm, sp, 4, x))				\
+		goto fault;						\
+	    }								\
+	  else								\
+	    {								\
+	      SPILL ();							\
+	      YESOD_SET_LE32 (m + sp, x);				\
+	    }								\
+									\
+	  pushes++;							\
+	  writes++;							\
+									\
+	  if ((uint32_t)(sp - base) < size				\
+	      || (uint32_t)(sp + 3 - base) < size)			\
+	    {								\
+	      yesod_predecode_invalidate (vm, sp, 4);			\
+	      yesod_blocks_flush (vm);					\
+	    }								\
+									\
+	  r[SP] += 4;							\
+	}								\
+    }									\
+  while (0)
+
+/* the ALU operations of classes I and II on `src` */
+#define EXEC_MOV				\
+  r[op->ra] = src;				\
+  FLAGSET (src)
+
+#define EXEC_ADD				\
+  {						\
+    uint32_t a = r[op->ra], x = a + src;	\
+						\
+    LAZY_ADD (lazy, a, src, x);			\
+    r[op->ra] = x;				\
+    FLAGSET (x);				\
+  }
+
+#define EXEC_SUB				\
+  {						\
+    uint32_t a = r[op->ra], x = a - src;	\
+						\
+    LAZY_SUB (lazy, a, src, x);			\
+    r[op->ra] = x;				\
+    FLAGSET (x);				\
+  }
+
+#define EXEC_AND				\
+  r[op->ra] &= src;				\
+  FLAGSET (r[op->ra])
+
+#define EXEC_OR					\
+  r[op->ra] |= src;				\
+  FLAGSET (r[op->ra])
+
+#define EXEC_XOR				\
+  r[op->ra] ^= src;				\
+  FLAGSET (r[op->ra])
+
+/* CAR and CDR trap on words not tagged cons, see tags.h */
+#define EXEC_CAR				\
+  if (YESOD_TAG_TRAP (&vm->tags, src))		\
+    goto type;					\
+  LOAD (op->ra, src, len)
+#define EXEC_CDR						\
+  {								\
+    uint32_t c = YESOD_CDR (&vm->cons, src);			\
+								\
+    if (YESOD_TAG_TRAP (&vm->tags, src))			\
+      goto type;						\
+								\
+    if (YESOD_CDR_CODED (c))					\
+      {								\
+	r[op->ra] = YESOD_CDR_OF (c, src);			\
+	FLAGSET (r[op->ra]);					\
+      }								\
+    else							\
+      LOAD (op->ra, src + (uint32_t)sizeof (uint32_t), len);	\
+  }
+
+#define EXEC_STR				\
+  {						\
+    uint32_t a = r[op->ra];			\
+						\
+    STORE (a, src, len);			\
+  }
+
+#define EXEC_CMP				\
+  {						\
+    uint32_t a = r[op->ra], x = a - src;	\
+						\
+    vm->tags.last = a ^ src;			\
+    LAZY_SUB (lazy, a, src, x);			\
+    r[0] = x;					\
+    FLAGSET (x);				\
+  }
+
+#define EXEC_JA r[PC] = src
+#define EXEC_JR r[PC] += src - 4 /* we've already incremented pc */
+
+/*
+ * the handlers, see handler.h. `len` is the number of bytes loads and
+ * stores access
+ */
+#define CLASS1(o, name, sh, sz, cc)					\
+  c1_##name##_##sh##_##sz##_##cc:					\
+  src = r[op->rb];							\
+  COND (cc);								\
+  src = YESOD_FIT_##sz (YESOD_SHIFT_##sh (src, COUNT));			\
+  len = YESOD_LEN_##sz;							\
+  EXEC_##o;								\
+  NEXT;
+
+#define CLASS2(o, name, u, cc)						\
+  c2_##name##_##u##_##cc:						\
+  COND (cc);								\
+  src = (uint32_t)op->imm << 16 * (u);					\
+  len = YESOD_LEN_WORD;							\
+  EXEC_##o;								\
+  NEXT;
+
+#define CLASS3(o, name, sh, sz, cc)					\
+  c3_##name##_##sh##_##sz##_##cc:					\
+  src = r[op->ra];							\
+  COND (cc);								\
+  src = YESOD_FIT_##sz (YESOD_SHIFT_##sh (src, COUNT));			\
+  PUSH (op->bits & OP_PUSH);						\
+  EXEC_##o;								\
+  NEXT;
+
+#define CLASS4(o, name, p, cc)						\
+  c4_##name##_##p##_##cc:						\
+  COND (cc);								\
+  src = op->imm | (r[op->ra] << 16);					\
+  PUSH (p);								\
+  EXEC_##o;								\
+  NEXT;
+
+#define FIXED(cc)							\
+  c1_hlt_##cc:								\
+  COND (cc);								\
+  goto halt;								\
+									\
+ invalid_##cc:								\
+  COND (cc);								\
+  goto invalid;								\
+									\
+ jump_invalid_##cc:							\
+  COND (cc);								\
+  PUSH (op->bits & OP_PUSH);						\
+  goto invalid;
+
+#define HANDLERS(cc)				\
+  YESOD_CLASS1_HANDLERS (CLASS1, cc)		\
+  YESOD_CLASS2_HANDLERS (CLASS2, cc)		\
+  YESOD_CLASS3_HANDLERS (CLASS3, cc)		\
+  YESOD_CLASS4_HANDLERS (CLASS4, cc)		\
+  FIXED (cc)
+
+/*
+ * fused pairs, see handler.h
+ *
+ * PAIR moves on to the second instruction, unless the budget ends the
+ * block right after the first one, `x0` being what the first one left
+ * in x0
+ */
+#define PAIR(x0)				\
+  do						\
+    {						\
+      if (++op == end)				\
+	{					\
+	  r[0] = (x0);				\
+	  goto chain;				\
+	}					\
+						\
+      pc += 4;					\
+      r[0] = 0;					\
+      r[PC] = pc + 4;				\
+    }						\
+  while (0)
+
+#define CMP_OPERAND1  r[op->rb]
+#define CMP_OPERAND2  op->imm
+#define JUMP_OPERAND3 r[op->ra]
+#define JUMP_OPERAND4 (op->imm | (r[op->ra] << 16))
+
+/* X (cmp class, jump class, jump opcode, name) for every fused CMP */
+#define FUSED_CMPS(X)						\
+  X (1, 3, JA, ja) X (1, 3, JR, jr) X (1, 4, JA, ja) X (1, 4, JR, jr)	\
+  X (2, 3, JA, ja) X (2, 3, JR, jr) X (2, 4, JA, ja) X (2, 4, JR, jr)
+
+/* the difference only stays in x0 if the pair is split */
+#define FUSED_CMP(c, j, o, name)				\
+  cmp##c##_##name##j:						\
+  src = CMP_OPERAND##c;						\
+  {								\
+    uint32_t a = r[op->ra], x = a - src;			\
+								\
+    vm->tags.last = a ^ src;					\
+    LAZY_SUB (lazy, a, src, x);					\
+    FLAGSET (x);						\
+    PAIR (x);							\
+  }								\
+  COND (1);							\
+  src = JUMP_OPERAND##j;					\
+  EXEC_##o;							\
+  NEXT;
+
+#define FUSED_ENTRY(c, j, o, name)					\
+  [YESOD_FUSED_CMP (INSTR_CLASS##c, INSTR_CLASS##j, o)] = &&cmp##c##_##name##j,
+
+#define LABEL(h) &&h
+
+struct yesod_stop
+yesod_run_threaded (vm, budget)
+     struct yesod_vm	*vm;
+     uint64_t		budget;
+{
+  static const void *const handlers[YESOD_HANDLERS + YESOD_FUSED] = {
+    YESOD_HANDLER_TABLE (LABEL, 0)
+    YESOD_HANDLER_TABLE (LABEL, 1)
+    [YESOD_FUSED_CONST] = &&fused_const,
+    FUSED_CMPS (FUSED_ENTRY)
+  };
+
+  uint32_t			*r = vm->regs;
+  uint8_t			*m = vm->memory.memory;
+  uint8_t			flags = vm->flags;
+  struct yesod_lazy		lazy = vm->lazy;
+  const uint32_t		base = vm->decoded.base;
+  const uint32_t		size = vm->decoded.size;
+  struct yesod_block		*blk, *next;
+  struct yesod_link		*link;
+  const struct yesod_op		*op, *end;
+  uint32_t			pc, src, id, ret, len;
+  const bool			tlb = vm->tlb.enabled;
+  const bool			protect = vm->memory.protect;
+  uint64_t			left = budget;
+  const uint64_t		retired = vm->counters.retired;
+  uint64_t			taken = 0, not_taken = 0, pushes = 0;
+  uint64_t			reads = 0, writes = 0;
+  uint32_t			top = vm->counters.sp;
+  struct yesod_stop		stop;
+
+  pc = r[PC];
+  blk = yesod_block_lookup (vm, pc);
+
+ enter:
+  if (left < blk->len)
+    {
+      if (!left)
+	goto budget;
+
+      /* run what the budget allows, and stop at the next block */
+      end = blk->ops + left;
+      left = 0;
+    }
+  else
+    {
+      end = blk->ops + blk->len;
+      left -= blk->len;
+    }
+
+  op = blk->ops;
+  pc = blk->pc;
+  RUN (pc, budget - left - (end - op));
+
+  /* blocks outside of .text are single instructions, see block.c */
+  if (!blk->id)
+    {
+      if (YESOD_SERVICE (vm, pc))
+	{
+	  SYNC_COUNTERS ();
+
+	  if ((ret = yesod_service (vm, pc)))
+	    {
+	      stop.reason = ret;
+	      goto refund;
+	    }
+
+	  blk = yesod_block_lookup (vm, r[PC]);
+	  goto enter;
+	}
+
+      if (tlb && yesod_tlb_fetch (vm, pc))
+	goto fault;
+    }
+
+  if (!blk->native && ++blk->hits == YESOD_JIT_THRESHOLD)
+    yesod_jit_compile (vm, blk);
+
+  if (blk->native && end == blk->ops + blk->len)
+    {
+      SPILL ();
+      vm->flags = flags;
+      vm->lazy = lazy;
+      ret = blk->native (vm);
+      flags = vm->flags;
+      lazy = vm->lazy;
+
+      if (!ret)
+	{
+	  vm->jit.native += blk->len;
+	  goto chain;
+	}
+
+      /* the interpreter picks up where the native code left */
+      vm->jit.native += --ret;
+      op += ret;
+      pc += 4 * ret;
+    }
+
+  DISPATCH ();
+
+  /* the block ran to its end, x14 holds the next pc */
+ chain:
+  pc = r[PC];
+
+  /* the jump ending the block, if any, see counters.h */
+  if (end[-1].class == INSTR_CLASS3 || end[-1].class == INSTR_CLASS4)
+    {
+      if (pc != blk->pc + 4 * (uint32_t)(end - blk->ops))
+	taken++;
+      else
+	not_taken++;
+    }
+
+  if (r[SP] > top)
+    top = r[SP];
+
+  /* the lookups below may fetch the next block */
+  SPILL ();
+  RUN (pc, budget - left);
+
+  if (YESOD_CHAINED (blk->next[0], pc))
+    {
+      blk = blk->next[0].block;
+      goto enter;
+    }
+
+  /*
+   * the last instruction run, which ends the block unless the budget
+   * did. jumps that are taken push their return address on the shadow
+   * stack, and indirect ones go through the target cache
+   */
+  op = end - 1;
+  src = blk->pc + 4 * (op - blk->ops);
+
+  if ((op->class == INSTR_CLASS3 || op->class == INSTR_CLASS4)
+      && pc != src + 4)
+    {
+      if (op->bits & OP_PUSH)
+	yesod_return_push (vm, src + 4, blk);
+
+      if (op->class == INSTR_CLASS3)
+	{
+	  blk = yesod_target_lookup (vm, src, pc,
+				     op->opcode == JA && !(op->bits & OP_PUSH));
+	  goto enter;
+	}
+    }
+
+  if (YESOD_CHAINED (blk->next[1], pc))
+    {
+      blk = blk->next[1].block;
+      goto enter;
+    }
+
+  /* the lookup may evict `blk`, in which case it is not chained */
+  id = blk->id;
+  next = yesod_block_lookup (vm, pc);
+
+  if (id && blk->id == id && next->id)
+    {
+      link = &blk->next[pc == blk->pc + 4 * blk->len ? 0 : 1];
+      link->pc = pc;
+      link->id = next->id;
+      link->block = next;
+    }
+
+  blk = next;
+  goto enter;
+
+  /* a store dropped the running block */
+ flushed:
+  left += end - op - 1;
+  pc = r[PC];
+  RUN (pc, budget - left);
+  blk = yesod_block_lookup (vm, pc);
+  goto enter;
+
+ c1_nop:
+  NEXT;
+
+  HANDLERS (0)
+  HANDLERS (1)
+
+ fused_const:
+  src = (uint32_t)op->imm << 16;
+  r[op->ra] = src;
+  FLAGSET (src);
+  PAIR (0);
+  src = op->imm;
+  EXEC_OR;
+  NEXT;
+
+  FUSED_CMPS (FUSED_CMP)
+
+ halt:
+  stop.reason = YESOD_HALT;
+
+  /* HLT retires, an instruction that traps does not */
+  left += end - op - 1;
+  goto out;
+
+ invalid:
+  stop.reason = YESOD_INVALID;
+  goto refund;
+
+ stack_overflow:
+  stop.reason = YESOD_STACK_OVERFLOW;
+  goto refund;
+
+ type:
+  stop.reason = YESOD_TYPE;
+  goto refund;
+
+ fault:
+  stop.reason = YESOD_FAULT;
+
+  /* the rest of the block was charged but not run */
+ refund:
+  left += end - op;
+  goto out;
+
+ budget:
+  stop.reason = YESOD_BUDGET;
+  pc = r[PC];
+
+ out:
+  vm->flags = flags;
+  vm->lazy = lazy;
+  SYNC_COUNTERS ();
+
+  stop.pc = pc;
+  stop.executed = budget - left;
+
+  return stop;
+}
+
+#endif /* __GNUC__ */
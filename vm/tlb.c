@@ -0,0 +1,142 @@
+#include "cycle.h"
+#include "tlb.h"
+
+/* permissions of the byte at `a`, see tlb.h */
+static uint32_t
+perms (vm, a)
+     struct yesod_vm	*vm;
+     uint32_t		a;
+{
+  if (a >= vm->memory.m_size)
+    return YESOD_COUNTED (vm, a) ? YESOD_PERM_R : 0;
+  if (a >= vm->text)
+    return YESOD_PERM_R | YESOD_PERM_X;
+  if (a >= vm->data)
+    return YESOD_PERM_R | YESOD_PERM_W;
+  if (a >= vm->rodata)
+    return YESOD_PERM_R;
+  if (a >= vm->heap)
+    return YESOD_PERM_R | YESOD_PERM_W;
+  if (vm->memory.protect && a >= vm->memory.guard)
+    return 0;
+
+  return YESOD_PERM_R | YESOD_PERM_W;
+}
+
+/* caches the permissions all of the page of `a` has */
+static void
+fill (vm, a)
+     struct yesod_vm	*vm;
+     uint32_t		a;
+{
+  uint32_t	start = a & ~(uint32_t)YESOD_PAGE_MASK, p, i;
+  uint32_t	bounds[6];
+
+  bounds[0] = vm->memory.guard;
+  bounds[1] = vm->heap;
+  bounds[2] = vm->rodata;
+  bounds[3] = vm->data;
+  bounds[4] = vm->text;
+  bounds[5] = vm->memory.m_size;
+
+  p = perms (vm, start);
+
+  for (i = 0; i < 6; i++)
+    if (bounds[i] - start - 1 < YESOD_PAGE_MASK)
+      p &= perms (vm, bounds[i]);
+
+  YESOD_TLB_ENTRY (vm, a) = (start >> YESOD_PAGE_BITS << 4) | (~p & 0xF);
+}
+
+static uint32_t
+fault (vm, pc, a, access)
+     struct yesod_vm	*vm;
+     uint32_t		pc;
+     uint32_t		a;
+     enum yesod_access	access;
+{
+  vm->fault.pc = pc;
+  vm->fault.addr = a;
+  vm->fault.access = access;
+
+  return YESOD_FAULT;
+}
+
+void
+yesod_tlb_init (vm)
+     struct yesod_vm *vm;
+{
+  uint32_t i;
+
+  for (i = 0; i < YESOD_TLB_ENTRIES; i++)
+    vm->tlb.entries[i] = ~(uint32_t)0;
+
+  vm->tlb.misses = 0;
+}
+
+/* the slow path of YESOD_LOAD, for an instruction run by an interpreter */
+uint32_t
+yesod_tlb_load (vm, a, len, x)
+     struct yesod_vm	*vm;
+     uint32_t		a;
+     uint32_t		len;
+     uint32_t		*x;
+{
+  uint8_t	*m = vm->memory.memory;
+  uint32_t	i, v = 0;
+
+  vm->tlb.misses++;
+
+  for (i = 0; i < len; i++)
+    if (!(perms (vm, a + i) & YESOD_PERM_R))
+      return fault (vm, vm->regs[PC] - 4, a + i, YESOD_READ);
+
+  fill (vm, a);
+
+  for (i = len; i--; )
+    v = (v << 8) | m[(uint32_t)(a + i)];
+
+  *x = v;
+
+  return 0;
+}
+
+/* the slow path of YESOD_STORE */
+uint32_t
+yesod_tlb_store (vm, a, len, x)
+     struct yesod_vm	*vm;
+     uint32_t		a;
+     uint32_t		len;
+     uint32_t		x;
+{
+  uint8_t	*m = vm->memory.memory;
+  uint32_t	i;
+
+  vm->tlb.misses++;
+
+  for (i = 0; i < len; i++)
+    if (!(perms (vm, a + i) & YESOD_PERM_W))
+      return fault (vm, vm->regs[PC] - 4, a + i, YESOD_WRITE);
+
+  fill (vm, a);
+
+  for (i = 0; i < len; i++)
+    m[(uint32_t)(a + i)] = (uint8_t)(x >> 8 * i);
+
+  return 0;
+}
+
+/* 0 if the word at `pc` can be executed, otherwise YESOD_FAULT */
+uint32_t
+yesod_tlb_fetch (vm, pc)
+     struct yesod_vm	*vm;
+     uint32_t		pc;
+{
+  uint32_t i;
+
+  for (i = 0; i < 4; i++)
+    if (!(perms (vm, pc + i) & YESOD_PERM_X))
+      return fault (vm, pc, pc + i, YESOD_FETCH);
+
+  return 0;
+}
@@ -0,0 +1,107 @@
+#ifndef YESOD_TLB_
+# define YESOD_TLB_
+
+# include <stdbool.h>
+# include <stdint.h>
+
+struct yesod_vm;
+
+/* guest pages, of 4KiB */
+# define YESOD_PAGE_BITS (12)
+# define YESOD_PAGE_MASK ((1 << YESOD_PAGE_BITS) - 1)
+
+/* entries of the TLB, a power of 2 */
+# ifndef YESOD_TLB_ENTRIES
+#  define YESOD_TLB_ENTRIES (64)
+# endif
+
+/* permissions of a region */
+# define YESOD_PERM_R (0b0001)
+# define YESOD_PERM_W (0b0010)
+# define YESOD_PERM_X (0b0100)
+
+/*
+ * software TLB, in checked mode
+ *
+ * every region of the layout (see `yesod_init_prog`) has permissions:
+ * the stack, the heap and .data can be read and written, .rodata only
+ * read, and .text read and executed. the guard page of protected mode
+ * and everything past the end of memory have none
+ *
+ * loads and stores access as many bytes as the size of their
+ * instruction (classes II to IV always use words), little-endian, in
+ * every mode; checked mode only adds the permissions. each entry holds
+ * the number of a page shifted left by 4, along with the permissions
+ * the whole page lacks, and accesses within a page cached without
+ * lacking the permission they need take a single host access. the
+ * others go through the regions and fault if any byte lacks the
+ * permission. since only .text is executable, fetches outside of it
+ * fault
+ */
+struct yesod_tlb {
+  bool		enabled;
+  uint32_t	entries[YESOD_TLB_ENTRIES];
+
+  uint64_t	misses;
+};
+
+# define YESOD_TLB_ENTRY(vm, a)						\
+  ((vm)->tlb.entries[((a) >> YESOD_PAGE_BITS) & (YESOD_TLB_ENTRIES - 1)])
+
+/* true if the `len` bytes at `a` are on a page cached with `perm` */
+# define YESOD_TLB_HIT(vm, a, len, perm)				\
+  (!((YESOD_TLB_ENTRY (vm, a) ^ ((a) >> YESOD_PAGE_BITS << 4))		\
+      & (~(uint32_t)0xF | (perm)))					\
+   && ((a) & YESOD_PAGE_MASK) <= YESOD_PAGE_MASK + 1 - (len))
+
+/* the `len` bytes at `p`, little-endian */
+# if defined (__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+typedef uint16_t yesod_le16 __attribute__ ((__may_alias__, __aligned__ (1)));
+typedef uint32_t yesod_le32 __attribute__ ((__may_alias__, __aligned__ (1)));
+
+#  define YESOD_LE16(p) (*(const yesod_le16 *)(p))
+#  define YESOD_LE32(p) (*(const yesod_le32 *)(p))
+#  define YESOD_SET_LE16(p, x) (*(yesod_le16 *)(p) = (uint16_t)(x))
+#  define YESOD_SET_LE32(p, x) (*(yesod_le32 *)(p) = (uint32_t)(x))
+# else
+#  define YESOD_LE16(p) ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8))
+#  define YESOD_LE32(p) (YESOD_LE16 (p) | (YESOD_LE16 ((p) + 2) << 16))
+#  define YESOD_SET_LE16(p, x)						\
+  ((p)[0] = (uint8_t)(x), (p)[1] = (uint8_t)((x) >> 8))
+#  define YESOD_SET_LE32(p, x)						\
+  (YESOD_SET_LE16 (p, x), YESOD_SET_LE16 ((p) + 2, (x) >> 16))
+# endif
+
+# define YESOD_LE(p, len)						\
+  ((len) == 4 ? YESOD_LE32 (p)						\
+   : (len) == 2 ? YESOD_LE16 (p)					\
+   : (len) == 3 ? YESOD_LE16 (p) | ((uint32_t)(p)[2] << 16)		\
+   : (p)[0])
+
+# define YESOD_SET_LE(p, len, x)					\
+  ((len) == 4 ? (void)YESOD_SET_LE32 (p, x)				\
+   : (len) == 2 ? (void)YESOD_SET_LE16 (p, x)				\
+   : (len) == 3 ? (void)(YESOD_SET_LE16 (p, x), (p)[2] = (uint8_t)((x) >> 16)) \
+   : (void)((p)[0] = (uint8_t)(x)))
+
+/*
+ * loads the `len` bytes at `a` into `x`, or stores the `len` low bytes
+ * of `x` at `a`, evaluating to 0, or to YESOD_FAULT once `vm->fault`
+ * is set
+ */
+# define YESOD_LOAD(vm, a, len, x)					\
+  (YESOD_TLB_HIT (vm, a, len, YESOD_PERM_R)				\
+   ? ((x) = YESOD_LE ((vm)->memory.memory + (a), len), 0)		\
+   : yesod_tlb_load (vm, a, len, &(x)))
+
+# define YESOD_STORE(vm, a, len, x)					\
+  (YESOD_TLB_HIT (vm, a, len, YESOD_PERM_W)				\
+   ? (YESOD_SET_LE ((vm)->memory.memory + (a), len, x), 0)		\
+   : yesod_tlb_store (vm, a, len, x))
+
+void		yesod_tlb_init (struct yesod_vm *);
+uint32_t	yesod_tlb_load (struct yesod_vm *, uint32_t, uint32_t, uint32_t *);
+uint32_t	yesod_tlb_store (struct yesod_vm *, uint32_t, uint32_t, uint32_t);
+uint32_t	yesod_tlb_fetch (struct yesod_vm *, uint32_t);
+
+#endif /* YESOD_TLB_ */
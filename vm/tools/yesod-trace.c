@@ -0,0 +1,140 @@
+/*
+ * trace decoder
+ *
+ * prints a trace file written by `yesod-vm -x` (see trace.h) as text,
+ * a line per record: the pc, the instruction word, its disassembly,
+ * then the register it wrote with its new value and the flags it left,
+ * or `skipped` if its condition did not hold
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include "vm.h"
+
+static const char *const conds[8] = {
+  "", ".ne", ".ltu", ".geu", ".eq", ".tag", ".lts", ".ges"
+};
+
+static const char *const shifts[4] = { "", "lsl", "lsr", "asr" };
+
+static const char *const sizes[4] = { "", ".d", ".h", ".b" };
+
+/* `, shift amount` of a class I or III instruction, if it shifts */
+static int
+shift (buf, len, type, shifti, v)
+     char	*buf;
+     size_t	len;
+     enum shift	type;
+     bool	shifti;
+     uint8_t	v;
+{
+  if (type == NONE)
+    return 0;
+
+  return snprintf (buf, len, shifti ? ", %s %u" : ", %s x%u",
+		   shifts[type], v);
+}
+
+/* writes the disassembly of `raw` to `buf` */
+static void
+disassemble (buf, len, raw)
+     char	*buf;
+     size_t	len;
+     uint32_t	raw;
+{
+  struct yesod_instruction	i = yesod_decode (raw);
+  struct yesod_instruction1	*c1 = &i.instr.instr1;
+  struct yesod_instruction2	*c2 = &i.instr.instr2;
+  struct yesod_instruction3	*c3 = &i.instr.instr3;
+  struct yesod_instruction4	*c4 = &i.instr.instr4;
+  int				n;
+
+  switch (i.class)
+    {
+    case INSTR_CLASS1:
+      if (c1->opcode == NOP || c1->opcode == HLT)
+	{
+	  snprintf (buf, len, "%s%s", yesod_opcode_name (c1->opcode),
+		    conds[c1->cond]);
+	  return;
+	}
+
+      n = snprintf (buf, len, "%s%s%s x%u, x%u", yesod_opcode_name (c1->opcode),
+		    sizes[c1->size], conds[c1->cond], c1->rd, c1->rs);
+      shift (buf + n, len - n, c1->shift, c1->shifti, c1->shift_v.imm);
+      break;
+    case INSTR_CLASS2:
+      snprintf (buf, len, c2->uplo ? "%s%s x%u, %#x << 16" : "%s%s x%u, %#x",
+		yesod_opcode_name (c2->opcode), conds[c2->cond], c2->rd, c2->imm);
+      break;
+    case INSTR_CLASS3:
+      n = snprintf (buf, len, "%s%s%s x%u", yesod_opcode_name (c3->opcode),
+		    sizes[c3->size], conds[c3->cond], c3->rs);
+      n += shift (buf + n, len - n, c3->shift, c3->shifti, c3->shift_v.imm);
+
+      if (c3->push)
+	snprintf (buf + n, len - n, ", push");
+      break;
+    case INSTR_CLASS4:
+      snprintf (buf, len, c4->push ? "%s%s x%u:%#06x, push" : "%s%s x%u:%#06x",
+		yesod_opcode_name (c4->opcode), conds[c4->cond], c4->rp, c4->imm);
+      break;
+    }
+}
+
+int
+main (argc, argv)
+     int argc;
+     char *const argv[];
+{
+  struct yesod_trace	t;
+  struct yesod_record	r;
+  FILE			*f;
+  char			text[64];
+
+  if (argc != 2)
+    {
+      fprintf (stderr, "usage: %s trace\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  f = fopen (argv[1], "rb");
+
+  if (!f)
+    {
+      perror ("yesod-trace");
+      return EXIT_FAILURE;
+    }
+
+  if (yesod_trace_header (f, &t))
+    {
+      fprintf (stderr, "yesod-trace: %s is not a trace\n", argv[1]);
+      fclose (f);
+      return EXIT_FAILURE;
+    }
+
+  if (t.hi)
+    printf ("# one in %u instructions, from %#010x to %#010x\n", t.every,
+	    t.lo, t.hi);
+  else
+    printf ("# one in %u instructions, from %#010x\n", t.every, t.lo);
+
+  while (!yesod_trace_read (f, &r))
+    {
+      disassemble (text, sizeof (text), r.word);
+      printf ("%#010x  %08x  %-28s", r.pc, r.word, text);
+
+      if (r.reg == YESOD_TRACE_SKIPPED)
+	printf ("skipped\n");
+      else if (r.reg == YESOD_TRACE_NONE)
+	printf ("flags %x\n", r.flags);
+      else if (r.reg == PC)
+	printf ("pc = %#010x, flags %x\n", r.value, r.flags);
+      else
+	printf ("x%u = %#010x, flags %x\n", r.reg, r.value, r.flags);
+    }
+
+  fclose (f);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,266 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "trace.h"
+#include "vm.h"
+
+/*
+ * reads `every[:lo[:hi]]` into `t`, `lo` and `hi` in any base strtoul
+ * takes. returns 1 if it is malformed
+ */
+int
+yesod_trace_parse (t, spec)
+     struct yesod_trace	*t;
+     const char		*spec;
+{
+  char *end;
+
+  t->every = strtoul (spec, &end, 0);
+  t->lo = t->hi = 0;
+
+  if (*end == ':')
+    {
+      t->lo = strtoul (end + 1, &end, 0);
+
+      if (*end == ':')
+	t->hi = strtoul (end + 1, &end, 0);
+    }
+
+  if (*end || !t->every || (t->hi && t->hi <= t->lo))
+    {
+      fprintf (stderr, "yesod: malformed trace filter %s, expected every[:lo[:hi]]\n",
+	       spec);
+      return 1;
+    }
+
+  return 0;
+}
+
+/* writes the records the VM pushed, until it is done */
+static void *
+writer (arg)
+     void *arg;
+{
+  struct yesod_trace		*t = arg;
+  const struct yesod_record	*r;
+  uint8_t			buf[256 * YESOD_TRACE_RECORD], *p;
+  uint32_t			head, tail, n;
+  struct timespec		nap;
+
+  nap.tv_sec = 0;
+  nap.tv_nsec = 100000;
+
+  /* only this thread writes the tail */
+  tail = t->tail;
+
+  for (;;)
+    {
+      head = __atomic_load_n (&t->head, __ATOMIC_ACQUIRE);
+
+      if (head == tail)
+	{
+	  if (__atomic_load_n (&t->done, __ATOMIC_ACQUIRE)
+	      && __atomic_load_n (&t->head, __ATOMIC_ACQUIRE) == tail)
+	    return NULL;
+
+	  nanosleep (&nap, NULL);
+	  continue;
+	}
+
+      for (n = 0, p = buf; head != tail && n < 256; n++, tail++)
+	{
+	  r = &t->ring[tail & (YESOD_TRACE_RING - 1)];
+	  YESOD_SET_LE32 (p, r->pc);
+	  YESOD_SET_LE32 (p + 4, r->word);
+	  YESOD_SET_LE32 (p + 8, r->value);
+	  p[12] = r->reg;
+	  p[13] = r->flags;
+	  p[14] = p[15] = 0;
+	  p += YESOD_TRACE_RECORD;
+	}
+
+      /* the copied slots go back to the VM */
+      __atomic_store_n (&t->tail, tail, __ATOMIC_RELEASE);
+
+      /* the records are dropped once the file fails, so the VM goes on */
+      if (!t->failed && fwrite (buf, YESOD_TRACE_RECORD, n, t->file) != n)
+	t->failed = true;
+    }
+}
+
+/* opens the trace file and starts its writer, returns 1 on error */
+int
+yesod_trace_init (vm)
+     struct yesod_vm *vm;
+{
+  struct yesod_trace	*t = &vm->trace;
+  uint8_t		header[YESOD_TRACE_HEADER];
+
+  t->ring = NULL;
+  t->file = NULL;
+  t->running = t->failed = t->done = false;
+  t->head = t->tail = 0;
+  t->records = t->stalls = 0;
+
+  if (!t->path)
+    return 0;
+
+  if (!t->every)
+    t->every = 1;
+
+  t->countdown = t->every;
+  t->ring = malloc (YESOD_TRACE_RING * sizeof (*t->ring));
+  t->file = fopen (t->path, "wb");
+
+  if (!t->ring || !t->file)
+    {
+      fprintf (stderr, "yesod: could not open the trace %s\n", t->path);
+      return 1;
+    }
+
+  memcpy (header, YESOD_TRACE_MAGIC, 4);
+  YESOD_SET_LE32 (header + 4, YESOD_TRACE_VERSION);
+  YESOD_SET_LE32 (header + 8, t->every);
+  YESOD_SET_LE32 (header + 12, t->lo);
+  YESOD_SET_LE32 (header + 16, t->hi);
+
+  if (fwrite (header, sizeof (header), 1, t->file) != 1
+      || pthread_create (&t->writer, NULL, writer, t))
+    {
+      fprintf (stderr, "yesod: could not start the trace %s\n", t->path);
+      return 1;
+    }
+
+  t->running = true;
+
+  return 0;
+}
+
+/* the register `op` writes to */
+static uint8_t
+written (op)
+     const struct yesod_op *op;
+{
+  if (op->class == INSTR_CLASS3 || op->class == INSTR_CLASS4)
+    return PC;
+
+  switch (op->opcode)
+    {
+    case NOP:
+    case HLT:
+    case STR:
+      return YESOD_TRACE_NONE;
+    case CMP:
+      return 0;
+    default:
+      return op->ra;
+    }
+}
+
+/*
+ * traces `op`, decoded from `word` at `pc`, which just ran if
+ * `executed` is set
+ */
+void
+yesod_trace_retire (vm, op, pc, word, executed)
+     struct yesod_vm		*vm;
+     const struct yesod_op	*op;
+     uint32_t			pc;
+     uint32_t			word;
+     bool			executed;
+{
+  struct yesod_trace	*t = &vm->trace;
+  struct yesod_record	*r;
+
+  if (pc < t->lo || (t->hi && pc >= t->hi) || --t->countdown)
+    return;
+
+  t->countdown = t->every;
+
+  /* a full ring waits for the writer */
+  if (t->head - __atomic_load_n (&t->tail, __ATOMIC_ACQUIRE)
+      == YESOD_TRACE_RING)
+    {
+      t->stalls++;
+
+      while (t->head - __atomic_load_n (&t->tail, __ATOMIC_ACQUIRE)
+	     == YESOD_TRACE_RING)
+	sched_yield ();
+    }
+
+  r = &t->ring[t->head & (YESOD_TRACE_RING - 1)];
+  r->pc = pc;
+  r->word = word;
+  r->reg = executed ? written (op) : YESOD_TRACE_SKIPPED;
+  r->value = r->reg < 16 ? vm->regs[r->reg] : 0;
+  r->flags = yesod_flags (vm);
+
+  __atomic_store_n (&t->head, t->head + 1, __ATOMIC_RELEASE);
+  t->records++;
+}
+
+/* drains the ring and closes the trace file */
+void
+yesod_trace_stop (t)
+     struct yesod_trace *t;
+{
+  if (t->running)
+    {
+      __atomic_store_n (&t->done, true, __ATOMIC_RELEASE);
+      pthread_join (t->writer, NULL);
+      t->running = false;
+    }
+
+  if (t->file && fclose (t->file))
+    t->failed = true;
+
+  if (t->failed)
+    fprintf (stderr, "yesod: could not write the trace %s\n", t->path);
+
+  free (t->ring);
+  t->file = NULL;
+  t->ring = NULL;
+  t->failed = false;
+}
+
+/* reads the header of a trace file into `t`, returns 1 if it is not one */
+int
+yesod_trace_header (f, t)
+     FILE		*f;
+     struct yesod_trace	*t;
+{
+  uint8_t header[YESOD_TRACE_HEADER];
+
+  if (fread (header, sizeof (header), 1, f) != 1
+      || memcmp (header, YESOD_TRACE_MAGIC, 4)
+      || YESOD_LE32 (header + 4) != YESOD_TRACE_VERSION)
+    return 1;
+
+  t->every = YESOD_LE32 (header + 8);
+  t->lo = YESOD_LE32 (header + 12);
+  t->hi = YESOD_LE32 (header + 16);
+
+  return 0;
+}
+
+/* reads the next record of a trace file, returns 1 past the last one */
+int
+yesod_trace_read (f, r)
+     FILE			*f;
+     struct yesod_record	*r;
+{
+  uint8_t buf[YESOD_TRACE_RECORD];
+
+  if (fread (buf, sizeof (buf), 1, f) != 1)
+    return 1;
+
+  r->pc = YESOD_LE32 (buf);
+  r->word = YESOD_LE32 (buf + 4);
+  r->value = YESOD_LE32 (buf + 8);
+  r->reg = buf[12];
+  r->flags = buf[13];
+
+  return 0;
+}
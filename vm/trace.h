@@ -0,0 +1,89 @@
+#ifndef YESOD_TRACE_
+# define YESOD_TRACE_
+
+# include <pthread.h>
+# include <stdbool.h>
+# include <stdint.h>
+# include <stdio.h>
+# include "decoder.h"
+
+struct yesod_vm;
+
+/* records the ring holds, a power of 2 */
+# ifndef YESOD_TRACE_RING
+#  define YESOD_TRACE_RING (1 << 16)
+# endif
+
+/* first bytes of a trace file, followed by the version */
+# define YESOD_TRACE_MAGIC   "YTRC"
+# define YESOD_TRACE_VERSION (1)
+
+/* bytes of the header, and of a record, in a trace file */
+# define YESOD_TRACE_HEADER (20)
+# define YESOD_TRACE_RECORD (16)
+
+/* `reg` of an instruction that wrote no register, or was skipped */
+# define YESOD_TRACE_NONE    (0xFF)
+# define YESOD_TRACE_SKIPPED (0xFE)
+
+/*
+ * trace record of an instruction run, or skipped, by the switch engine
+ *
+ * `value` is what the instruction wrote to `reg`, the new pc for jumps
+ * and x0 for CMP, and `flags` the flags it left (see flags.h). in a
+ * trace file, the fields are little-endian, in this order, `reg` and
+ * `flags` being followed by 2 bytes of 0
+ */
+struct yesod_record {
+  uint32_t	pc;
+  uint32_t	word;
+  uint32_t	value;
+  uint8_t	reg;
+  uint8_t	flags;
+};
+
+/*
+ * execution tracer
+ *
+ * the VM pushes a record of every instruction it retires into a
+ * single-producer, single-consumer ring, which a writer thread drains
+ * to the trace file. neither side takes a lock: the VM only moves
+ * `head`, and the writer `tail`, the other side reading it with
+ * acquire semantics. a full ring makes the VM wait for the writer,
+ * which counts as a stall, so that a trace is never missing records
+ *
+ * only instructions whose pc is in [lo, hi) are traced, or above `lo`
+ * if `hi` is 0, one in `every` of them. the file starts with a header
+ * of YESOD_TRACE_MAGIC and the version, `every`, `lo` and `hi`, as
+ * little-endian words. tracing makes the VM run with the switch
+ * engine, which the hook is in
+ */
+struct yesod_trace {
+  const char		*path;		/* NULL while tracing is off */
+  uint32_t		every;
+  uint32_t		lo;
+  uint32_t		hi;
+  uint32_t		countdown;
+
+  struct yesod_record	*ring;
+  uint32_t		head;		/* next record to push, VM side */
+  uint32_t		tail;		/* next record to write, writer side */
+  bool			done;
+
+  FILE			*file;
+  pthread_t		writer;
+  bool			running;
+  bool			failed;		/* the writer could not write */
+
+  uint64_t		records;
+  uint64_t		stalls;
+};
+
+int	yesod_trace_parse (struct yesod_trace *, const char *);
+int	yesod_trace_init (struct yesod_vm *);
+void	yesod_trace_retire (struct yesod_vm *, const struct yesod_op *, uint32_t, uint32_t, bool);
+void	yesod_trace_stop (struct yesod_trace *);
+int	yesod_trace_header (FILE *, struct yesod_trace *);
+int	yesod_trace_read (FILE *, struct yesod_record *);
+
+#endif /* YESOD_TRACE_ */
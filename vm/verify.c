@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <string.h>
+#include "verify.h"
+#include "vm.h"
+
+/* true if `op` is a valid instruction of its class */
+static bool
+valid (op)
+     const struct yesod_op *op;
+{
+  switch (op->class)
+    {
+    case INSTR_CLASS1:
+      return op->opcode <= STR || op->opcode == HLT || op->opcode == CMP;
+    case INSTR_CLASS2:
+      return (op->opcode >= MOV && op->opcode <= STR) || op->opcode == CMP;
+    case INSTR_CLASS3:
+    case INSTR_CLASS4:
+      return op->opcode == JA || op->opcode == JR;
+    }
+
+  return false;
+}
+
+/* true if `op` leaves for a target not known before it runs */
+static bool
+indirect (op)
+     const struct yesod_op *op;
+{
+  switch (op->class)
+    {
+    case INSTR_CLASS1:
+    case INSTR_CLASS2:
+      return op->ra == PC && op->opcode >= MOV && op->opcode <= CDR;
+    case INSTR_CLASS3:
+      return true;
+    case INSTR_CLASS4:
+      return op->ra != 0;
+    }
+
+  return false;
+}
+
+/*
+ * marks every word of .text from scratch, returns 1 if `strict` is set
+ * and one is not a valid instruction
+ */
+static int
+mark (vm, strict)
+     struct yesod_vm	*vm;
+     bool		strict;
+{
+  struct yesod_cfg	*g = &vm->cfg;
+  const struct yesod_op	*op;
+  uint32_t		i, pc, t, leader = 0;
+
+  g->leaders = g->targets = g->indirect = g->invalid = 0;
+  g->stale = false;
+  memset (g->marks, 0, g->words);
+
+  if (g->words)
+    g->marks[0] |= CFG_LEADER;
+
+  for (i = 0, pc = g->base; i < g->words; i++, pc += 4)
+    {
+      op = yesod_predecode_fill (vm, pc);
+
+      if (!valid (op))
+	{
+	  g->marks[i] |= CFG_INVALID;
+	  g->invalid++;
+
+	  if (strict)
+	    {
+	      fprintf (stderr, "yesod: invalid instruction at %#010x\n", pc);
+	      return 1;
+	    }
+	}
+      else if (indirect (op))
+	g->marks[i] |= CFG_JUMP;
+      else if (op->class == INSTR_CLASS4)
+	{
+	  /* JR lands at `pc + 4 + imm - 4` */
+	  t = op->opcode == JR ? pc + op->imm : op->imm;
+
+	  if ((uint32_t)(t - g->base) < 4 * g->words && !((t - g->base) & 3))
+	    g->marks[(t - g->base) >> 2] |= CFG_LEADER | CFG_TARGET;
+	}
+
+      if (yesod_block_ends (op) && i + 1 < g->words)
+	g->marks[i + 1] |= CFG_LEADER;
+    }
+
+  for (i = 0; i < g->words; i++)
+    {
+      if (g->marks[i] & CFG_LEADER)
+	{
+	  leader = i;
+	  g->leaders++;
+	}
+
+      if (g->marks[i] & CFG_TARGET)
+	g->targets++;
+
+      if ((g->marks[i] & CFG_JUMP) && !(g->marks[leader] & CFG_INDIRECT))
+	{
+	  g->marks[leader] |= CFG_INDIRECT;
+	  g->indirect++;
+	}
+    }
+
+  return 0;
+}
+
+/* decodes and marks .text, see verify.h */
+int
+yesod_verify (vm)
+     struct yesod_vm *vm;
+{
+  struct yesod_cfg *g = &vm->cfg;
+
+  g->base = vm->decoded.base;
+  g->words = vm->decoded.size / 4;
+  g->marks = calloc (g->words + 1, 1);
+
+  if (!g->marks)
+    {
+      fprintf (stderr, "yesod: could not allocate the control-flow graph\n");
+      return 1;
+    }
+
+  return mark (vm, g->strict);
+}
+
+/*
+ * marks .text again once it was stored to, words that became invalid
+ * being only marked as such, as the program is already running
+ */
+void
+yesod_cfg_refresh (vm)
+     struct yesod_vm *vm;
+{
+  if (vm->cfg.stale && vm->cfg.marks)
+    mark (vm, false);
+}
+
+void
+yesod_cfg_destroy (vm)
+     struct yesod_vm *vm;
+{
+  free (vm->cfg.marks);
+  vm->cfg.marks = NULL;
+  vm->cfg.words = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef YESOD_VERIFY_
+# define YESOD_VERIFY_
+
+# include <stdbool.h>
+# include <stdint.h>
+
+struct yesod_vm;
+
+/* marks of a word of .text */
+# define CFG_LEADER   (0b00000001)	/* starts a block */
+# define CFG_TARGET   (0b00000010)	/* target of a direct jump */
+# define CFG_INDIRECT (0b00000100)	/* on a leader, the block has an indirect jump */
+# define CFG_INVALID  (0b00001000)	/* not a valid instruction */
+# define CFG_JUMP     (0b00010000)	/* indirect jump */
+
+/*
+ * load-time check of .text
+ *
+ * every word of .text is decoded into the predecoded instruction
+ * cache, and marked. if `strict` is set, programs with invalid
+ * instructions are rejected, and otherwise they are counted. the
+ * engines translate blocks as they reach them (see block.h) and do
+ * not read the marks: only the profiler does, to sum its counts by
+ * block (see prof.h), along with what `yesod_init_prog` reports
+ *
+ * blocks start at .text, at the targets of class IV jumps through x0,
+ * and after every instruction that ends a block (see block.c). jumps
+ * whose target depends on a register are indirect, whatever the
+ * register holds: class III ones, class IV ones through any register
+ * but x0, and writes to x14
+ *
+ * stores into .text leave the marks `stale`, and they are worked out
+ * again by `yesod_cfg_refresh` before they are next read
+ */
+struct yesod_cfg {
+  bool		strict;
+  uint32_t	base;
+  uint32_t	words;
+  uint8_t	*marks;
+  bool		stale;
+
+  uint32_t	leaders;
+  uint32_t	targets;
+  uint32_t	indirect;	/* blocks with an indirect jump */
+  uint32_t	invalid;
+};
+
+int	yesod_verify (struct yesod_vm *);
+void	yesod_cfg_refresh (struct yesod_vm *);
+void	yesod_cfg_destroy (struct yesod_vm *);
+
+#endif /* YESOD_VERIFY_ */
@@ -1,4 +1,9 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "vm.h"
 
 int
@@ -7,17 +12,58 @@ yesod_init_vm (vm, mem, stack)
      uint32_t		mem;
      uint32_t		stack;
 {
-  struct yesod_mem memory;
-
-  memory.m_size = mem;
-  memory.s_size = stack;
-  memory.memory = malloc (mem);
-
-  if (!memory.memory)
+  if (yesod_mem_init (&vm->memory, mem, stack))
     return 1;
 
-  vm->memory = memory;
   vm->flags = 0;
+  vm->lazy.nil = vm->lazy.carry = vm->lazy.sign = vm->lazy.over = 0;
+
+  vm->decoded.base = 0;
+  vm->decoded.size = 0;
+  vm->decoded.ops = NULL;
+
+  vm->cfg.strict = false;
+  vm->cfg.marks = NULL;
+  vm->cfg.stale = false;
+  vm->cfg.words = 0;
+
+  vm->blocks.capacity = YESOD_BLOCKS_DEFAULT;
+  vm->blocks.ring = NULL;
+  vm->blocks.table = NULL;
+
+  vm->jit.enabled = true;
+  vm->jit.arena = NULL;
+
+  vm->engine = YESOD_ENGINE_SWITCH;
+
+  vm->fault.pc = vm->fault.addr = 0;
+  vm->fault.access = YESOD_READ;
+  vm->fault.fetching = 0;
+
+  vm->tlb.enabled = false;
+  vm->cons.coded = false;
+  vm->cons.forwarded = NULL;
+  vm->cons.codes = NULL;
+
+  vm->tags.bits = 0;
+  vm->tags.mask = vm->tags.last = 0;
+
+  memset (&vm->icache, 0, sizeof (vm->icache));
+  memset (&vm->dcache, 0, sizeof (vm->dcache));
+
+  vm->pipe.enabled = false;
+  vm->pipe.latency = 0;
+
+  vm->prof.enabled = false;
+  vm->prof.pcs = NULL;
+  vm->prof.frames = NULL;
+
+  vm->counters.page = false;
+
+  vm->trace.path = NULL;
+  vm->trace.ring = NULL;
+  vm->trace.file = NULL;
+  vm->trace.running = false;
 
   printf ("yesod: initialised VM with %u bytes of memory (%u bytes (%u words) stack)\n",
 	  mem, stack, stack / 4);
@@ -48,62 +94,184 @@ yesod_init_vm (vm, mem, stack)
  * |                      0                     |
  * |--------------------------------------------|
  */
-int
-yesod_init_prog (vm, f)
-     struct yesod_vm	*vm;
-     FILE		*f;
+/* the header, up to and including the version */
+#define HEADER (24)
+
+/* pages .text is lined up with, the same on every host, see `load` */
+#define ALIGN (YESOD_PAGE_MASK + 1)
+
+/*
+ * the whole binary, mapped read-only if `f` is a regular file, in
+ * which case `fd` is set to its descriptor, and otherwise read
+ */
+static uint8_t *
+open_image (f, length, fd)
+     FILE	*f;
+     size_t	*length;
+     int	*fd;
 {
-  uint8_t	buffer[4], version;
-  uint32_t	size, t_size, r_size, d_size;
+  struct stat	st;
+  uint8_t	*image = NULL, *grown;
+  size_t	capacity = 0, n;
+
+  *fd = fileno (f);
 
-  if (fread (buffer, 1, 4, f) != 4)
+  if (*fd >= 0 && !fstat (*fd, &st) && S_ISREG (st.st_mode) && st.st_size > 0)
     {
-      perror ("yesod");
-      return 1;
+      image = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, *fd, 0);
+
+      if (image != MAP_FAILED)
+	{
+	  *length = st.st_size;
+	  return image;
+	}
     }
 
-  if (buffer[0] != 'Y'
-      || buffer[1] != 'S'
-      || buffer[2] != 'W'
-      || buffer[3] != 'D')
+  *fd = -1;
+  *length = 0;
+
+  do
     {
-      fprintf (stderr, "yesod: invalid magic number\n");
-      return 1;
+      if (*length == capacity)
+	{
+	  capacity = capacity ? 2 * capacity : 4096;
+	  grown = realloc (image, capacity);
+
+	  if (!grown)
+	    {
+	      free (image);
+	      return NULL;
+	    }
+
+	  image = grown;
+	}
+
+      n = fread (image + *length, 1, capacity - *length, f);
+      *length += n;
     }
+  while (n);
 
-  if (fread (buffer, 1, 4, f) != 4)
+  if (ferror (f))
     {
-      perror ("yesod");
-      return 1;
+      free (image);
+      return NULL;
     }
 
-  size = ARRAY_TO_UINT32_T(buffer);
+  return image;
+}
+
+static void
+close_image (image, length, fd)
+     uint8_t	*image;
+     size_t	length;
+     int	fd;
+{
+  if (fd >= 0)
+    munmap (image, length);
+  else
+    free (image);
+}
 
-  if (fread (buffer, 1, 4, f) != 4)
+/*
+ * puts the `size` bytes of the binary at `offset` in guest memory at
+ * `addr`, which the guest may only read if `ro` is set
+ *
+ * the whole pages of the section that line up with pages of the file
+ * are mapped over guest memory, private so that stores only copy the
+ * pages they touch, or read-only if `ro` is set, and the partial pages
+ * at its ends are copied
+ */
+static int
+place (vm, image, fd, offset, addr, size, ro)
+     struct yesod_vm	*vm;
+     const uint8_t	*image;
+     int		fd;
+     size_t		offset;
+     uint32_t		addr;
+     uint32_t		size;
+     bool		ro;
+{
+  uintptr_t	to = (uintptr_t)(vm->memory.memory + addr);
+  uintptr_t	page = sysconf (_SC_PAGESIZE), start, end;
+
+  start = (to + page - 1) & ~(page - 1);
+  end = (to + size) & ~(page - 1);
+
+  if (fd < 0 || (to - offset) % page || start >= end)
+    {
+      memcpy ((uint8_t *)to, image + offset, size);
+      return 0;
+    }
+
+  if (mmap ((void *)start, end - start,
+	    ro ? PROT_READ : PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset + (start - to)) == MAP_FAILED)
     {
       perror ("yesod");
       return 1;
     }
 
-  t_size = ARRAY_TO_UINT32_T(buffer);
-  vm->text = vm->memory.m_size - t_size;
+  memcpy ((uint8_t *)to, image + offset, start - to);
+  memcpy ((uint8_t *)end, image + offset + (end - to), to + size - end);
+  vm->memory.mapped += end - start;
+
+  return 0;
+}
+
+/*
+ * validates the header of the binary and puts its sections in memory
+ *
+ * they are laid out down from the end of memory, .text last, without
+ * gaps between them. once .text holds a whole page wherever it starts,
+ * all of them move down by less than ALIGN bytes, to where .text lines
+ * up with its pages in the file, so that `place` can map them. the
+ * words past .text are then zeros, that is NOPs
+ */
+static int
+load (vm, image, length, fd)
+     struct yesod_vm	*vm;
+     const uint8_t	*image;
+     size_t		length;
+     int		fd;
+{
+  uint8_t	version;
+  uint32_t	size, t_size, r_size, d_size, pad = 0;
+  size_t	end;
+  bool		ro;
 
-  if (fread (buffer, 1, 4, f) != 4)
+  if (length < 4)
     {
-      perror ("yesod");
+      fprintf (stderr, "yesod: truncated binary\n");
       return 1;
     }
 
-  d_size = ARRAY_TO_UINT32_T(buffer);
-  vm->data = vm->text - d_size;
+  if (image[0] != 'Y'
+      || image[1] != 'S'
+      || image[2] != 'W'
+      || image[3] != 'D')
+    {
+      fprintf (stderr, "yesod: invalid magic number\n");
+      return 1;
+    }
 
-  if (fread (buffer, 1, 4, f) != 4)
+  if (length < HEADER)
     {
-      perror ("yesod");
+      fprintf (stderr, "yesod: truncated binary\n");
       return 1;
     }
 
-  r_size = ARRAY_TO_UINT32_T(buffer);
+  size = ARRAY_TO_UINT32_T((image + 4));
+
+  t_size = ARRAY_TO_UINT32_T((image + 8));
+
+  if (t_size >= 2 * ALIGN - HEADER)
+    pad = (vm->memory.m_size - t_size - HEADER) & (ALIGN - 1);
+
+  vm->text = vm->memory.m_size - t_size - pad;
+
+  d_size = ARRAY_TO_UINT32_T((image + 12));
+  vm->data = vm->text - d_size;
+
+  r_size = ARRAY_TO_UINT32_T((image + 16));
   vm->rodata = vm->data - r_size;
 
   if (t_size + d_size + r_size != size - 22)
@@ -112,10 +280,10 @@ yesod_init_prog (vm, f)
 	       size, t_size + d_size + r_size);
 
       return 1;
-	       
     }
 
-  if (t_size + d_size + r_size + vm->memory.s_size > vm->memory.m_size)
+  if ((uint64_t)t_size + d_size + r_size + pad + YESOD_MEM_HEAP (&vm->memory)
+      > vm->memory.m_size)
     {
       fprintf (stderr, "yesod: binary too large (%u bytes) for allocated memory (%u)\n",
 	       t_size + d_size + r_size, vm->memory.m_size);
@@ -123,68 +291,143 @@ yesod_init_prog (vm, f)
       return 1;
     }
 
-  if (fread (buffer, 1, 4, f) != 4)
+  version = ARRAY_TO_UINT32_T((image + 20));
+
+  if (version != YESOD_VERSION)
     {
-      perror ("yesod");
+      fprintf (stderr, "yesod: program version (%u) incoherent with emulator version (%u)\n",
+	       version, YESOD_VERSION);
+
       return 1;
     }
 
-  version = ARRAY_TO_UINT32_T(buffer);
+  end = (size_t)HEADER + t_size + r_size + d_size;
 
-  if (version != YESOD_VERSION)
+  if (length <= end)
     {
-      fprintf (stderr, "yesod: program version (%u) incoherent with emulator version (%u)\n",
-	       version, YESOD_VERSION);
+      fprintf (stderr, "yesod: truncated binary\n");
+      return 1;
+    }
+
+  if (image[end] != 0)
+    {
+      fprintf (stderr, "yesod: missing zero terminator at binary file end\n");
 
       return 1;
     }
 
-  if (fread (vm->memory.memory + vm->text, 1, t_size, f) != t_size)
+  vm->memory.mapped = 0;
+
+  /* the guest cannot store into .text or .rodata in checked mode */
+  ro = vm->tlb.enabled;
+
+  return place (vm, image, fd, HEADER, vm->text, t_size, ro)
+    || place (vm, image, fd, HEADER + t_size, vm->rodata, r_size, ro)
+    || place (vm, image, fd, HEADER + t_size + r_size, vm->data, d_size,
+	      false);
+}
+
+int
+yesod_init_prog (vm, f)
+     struct yesod_vm	*vm;
+     FILE		*f;
+{
+  uint8_t	*image;
+  size_t	length;
+  int		fd, err;
+
+  if (vm->tags.bits > YESOD_TAG_BITS
+      || (vm->cons.coded && vm->tags.bits > 2))
     {
-      perror ("yesod");
+      fprintf (stderr, "yesod: %u tag bits are more than cells leave (%u)\n",
+	       vm->tags.bits, vm->cons.coded ? 2 : YESOD_TAG_BITS);
       return 1;
     }
 
-    if (fread (vm->memory.memory + vm->rodata, 1, r_size, f) != r_size)
+  vm->tags.mask = ((uint32_t)1 << vm->tags.bits) - 1;
+
+  if (vm->memory.protect && yesod_mem_protect (&vm->memory))
     {
-      perror ("yesod");
+      fprintf (stderr, "yesod: could not set up the guard pages\n");
       return 1;
     }
 
-    if (fread (vm->memory.memory + vm->data, 1, d_size, f) != d_size)
+  image = open_image (f, &length, &fd);
+
+  if (!image)
     {
       perror ("yesod");
       return 1;
     }
 
-    buffer[0] = 1;
+  err = load (vm, image, length, fd);
+  close_image (image, length, fd);
+
+  if (err)
+    return 1;
+
+  vm->heap = YESOD_MEM_HEAP (&vm->memory);
+
+  if (yesod_predecode_init (vm))
+    {
+      fprintf (stderr, "yesod: could not allocate the predecoded instruction cache\n");
+
+      return 1;
+    }
+
+  if (yesod_verify (vm))
+    return 1;
+
+  if (yesod_blocks_init (vm))
+    {
+      fprintf (stderr, "yesod: could not allocate the block cache\n");
+
+      return 1;
+    }
+
+  if (yesod_heap_init (vm))
+    {
+      fprintf (stderr, "yesod: could not allocate the cons heap\n");
+
+      return 1;
+    }
+
+  if (yesod_cache_init (vm, &vm->icache) || yesod_cache_init (vm, &vm->dcache)
+      || yesod_prof_init (vm) || yesod_trace_init (vm))
+    return 1;
 
-    if (fread (buffer, 1, 1, f) != 1)
-      {
-	perror ("yesod");
-	return 1;
-      }
+  yesod_targets_init (vm);
+  yesod_tlb_init (vm);
+  yesod_cards_init (vm);
+  yesod_pipe_init (vm);
+  yesod_counters_init (vm);
+  yesod_jit_init (vm);
 
-    if (buffer[0] != 0)
-      {
-	fprintf (stderr, "yesod: missing zero terminator at binary file end\n");
+  printf ("yesod: program initialised succesfully\n");
+  printf ("  stack\t%#010x\n", 0);
 
-	return 1;
-      }
+  if (vm->memory.protect)
+    printf ("  guard\t%#010x\n", vm->memory.guard);
 
-    vm->heap = vm->memory.s_size;
+  printf ("  heap\t%#010x\n", vm->heap);
+  printf ("  .data\t%#010x\n", vm->data);
+  printf ("  .rodata\t%#010x\n", vm->rodata);
+  printf ("  .text\t%#010x\n", vm->text);
+  printf ("  mapped\t%u bytes of %u\n", vm->memory.mapped,
+	  vm->memory.m_size - vm->rodata);
+  printf ("  blocks\t%u (%u with indirect jumps, %u jump targets)\n",
+	  vm->cfg.leaders, vm->cfg.indirect, vm->cfg.targets);
 
-    printf ("yesod: program initialised succesfully\n");
-    printf ("  stack\t%#010x\n", 0);
-    printf ("  heap\t%#010x\n", vm->heap);
-    printf ("  .data\t%#010x\n", vm->data);
-    printf ("  .rodata\t%#010x\n", vm->rodata);
-    printf ("  .text\t%#010x\n", vm->text);
+  if (vm->tags.bits)
+    printf ("  tags\t%u bits\n", vm->tags.bits);
 
-    vm->regs[PC] = vm->text;
-    vm->regs[SP] = 0;
+  if (vm->cfg.invalid)
+    printf ("yesod: %u invalid words in .text\n", vm->cfg.invalid);
 
-    return 0;
+  vm->regs[PC] = vm->text;
+  vm->regs[SP] = 0;
+
+  return 0;
 }
 
 void
@@ -198,12 +441,32 @@ yesod_dump_vm (vm)
       printf ("  x%d\t%#010x (%u)\n", i, vm->regs[i], vm->regs[i]);
     }
 
-  printf ("  flags\t%x\n", vm->flags);
+  printf ("  flags\t%x\n", yesod_flags (vm));
+}
+
+/* folds the pending flags in, see flags.h */
+uint8_t
+yesod_flags (vm)
+     struct yesod_vm *vm;
+{
+  vm->flags = LAZY_FOLD (vm->flags, vm->lazy);
+  vm->lazy.nil = vm->lazy.carry = vm->lazy.sign = vm->lazy.over = 0;
+
+  return vm->flags;
 }
 
 void
 yesod_destroy_vm (vm)
      struct yesod_vm *vm;
 {
-  free (vm->memory.memory);
+  yesod_trace_stop (&vm->trace);
+  yesod_prof_destroy (&vm->prof);
+  yesod_cache_destroy (&vm->icache);
+  yesod_cache_destroy (&vm->dcache);
+  yesod_heap_destroy (vm);
+  yesod_jit_destroy (vm);
+  yesod_blocks_destroy (vm);
+  yesod_cfg_destroy (vm);
+  yesod_predecode_destroy (vm);
+  yesod_mem_destroy (&vm->memory);
 }
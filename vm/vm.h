@@ -4,12 +4,34 @@
 # include <stdint.h>
 # include <stdio.h>
 # include "mem.h"
+# include "flags.h"
+# include "predecode.h"
+# include "block.h"
+# include "target.h"
+# include "verify.h"
+# include "fault.h"
+# include "tlb.h"
+# include "heap.h"
+# include "service.h"
+# include "tags.h"
+# include "cards.h"
+# include "cache.h"
+# include "pipe.h"
+# include "prof.h"
+# include "counters.h"
+# include "trace.h"
 
 #define YESOD_VERSION (0)
 
 # define PC (14)
 # define SP (15)
 
+/* execution engines, see `yesod_run` */
+enum yesod_engine {
+  YESOD_ENGINE_SWITCH,		/* yesod_cycle, one call per instruction */
+  YESOD_ENGINE_THREADED		/* threaded dispatch, see threaded.c */
+};
+
 struct yesod_vm {
   /* register x0 holds the 0 value at all times */
   /* pc in x14 and sp in x15 */
@@ -30,18 +52,65 @@ struct yesod_vm {
    * 2 - sign
    * 3 - overflow
    * 4..7 - reserved
+   *
+   * read through `yesod_flags`, some may still be pending in `lazy`
    */
-  uint8_t	flags;
-};
+  uint8_t		flags;
+  struct yesod_lazy	lazy;
+
+  /* predecoded .text, see predecode.h */
+  struct yesod_predecode	decoded;
+
+  /* load-time check and block marks of .text, see verify.h */
+  struct yesod_cfg	cfg;
+
+  /* translated blocks, see block.h */
+  struct yesod_blocks	blocks;
+
+  /* native code for hot blocks, see jit.h */
+  struct yesod_jit	jit;
+
+  /* prediction of indirect jumps, see target.h */
+  struct yesod_targets	targets;
+
+  enum yesod_engine	engine;
+
+  /* last memory fault, see fault.h */
+  struct yesod_fault	fault;
 
-# define FLAG_NIL   (0b00000001)
-# define FLAG_CARRY (0b00000010)
-# define FLAG_SIGN  (0b00000100)
-# define FLAG_OVER  (0b00001000)
+  /* permissions of memory in checked mode, see tlb.h */
+  struct yesod_tlb	tlb;
+
+  /* native cons heap, see heap.h */
+  struct yesod_heap	cons;
+
+  /* type tags of tagged mode, see tags.h */
+  struct yesod_tags	tags;
+
+  /* card table of guest collectors, see cards.h */
+  struct yesod_cards	cards;
+
+  /* models of the L1 caches, see cache.h */
+  struct yesod_cache	icache;
+  struct yesod_cache	dcache;
+
+  /* pipeline timing model, see pipe.h */
+  struct yesod_pipe	pipe;
+
+  /* execution profile, see prof.h */
+  struct yesod_prof	prof;
+
+  /* performance counters, see counters.h */
+  struct yesod_counters	counters;
+
+  /* execution trace, see trace.h */
+  struct yesod_trace	trace;
+};
 
 int	yesod_init_vm (struct yesod_vm *, uint32_t, uint32_t);
 int	yesod_init_prog (struct yesod_vm *, FILE *);
 void	yesod_dump_vm (struct yesod_vm *);
+uint8_t	yesod_flags (struct yesod_vm *);
 void	yesod_destroy_vm (struct yesod_vm *);
 
 #endif /* YESOD_VM_ */